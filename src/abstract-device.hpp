@@ -6,6 +6,8 @@ class Device {
     virtual auto write(const void* ptr, int size) -> bool = 0;
     virtual auto read(void* ptr, int size) -> int         = 0;
     virtual auto read_struct(void* ptr, int size) -> bool = 0;
+    // whether data arrives within timeout_ms, for probing a link in an unknown state
+    virtual auto wait_readable(int timeout_ms) -> bool = 0;
 
     virtual ~Device() {}
 };
@@ -0,0 +1,121 @@
+#include <array>
+#include <chrono>
+#include <cstring>
+
+#include <sys/stat.h>
+
+#include "attach.hpp"
+#include "config.hpp"
+#include "firehose-actions.hpp"
+#include "firehose-xml.hpp"
+#include "macros/unwrap.hpp"
+#include "sahara-actions.hpp"
+#include "sahara.hpp"
+
+namespace attach {
+namespace {
+constexpr auto settle_ms = 50; // a response is complete when nothing arrives for this long
+
+const auto nop = fh::xml_header + "<data><nop /></data>";
+
+// discards whatever the device still sends, so that the next command starts on a clean link
+auto drain(Device& dev) -> void {
+    auto buf = std::array<std::byte, 4096>();
+    while(dev.wait_readable(settle_ms) && dev.read(buf.data(), buf.size()) > 0) {
+    }
+}
+
+// classifies the next bytes from the device
+auto receive_state(Device& dev) -> std::optional<State> {
+    auto       buf = std::array<std::byte, 4096>();
+    const auto len = dev.read(buf.data(), buf.size());
+    ensure(len > 0, "failed to read from device");
+
+    if(std::string_view(std::bit_cast<const char*>(buf.data()), len).starts_with("<?xml")) {
+        drain(dev);
+        return State::Firehose;
+    }
+    if(size_t(len) < sizeof(sahara::packet::Header)) {
+        drain(dev);
+        return State::Unknown;
+    }
+    const auto& header = *std::bit_cast<sahara::packet::Header*>(buf.data());
+    if(header.command == sahara::Command::Hello && header.length == sizeof(sahara::packet::Hello)) {
+        if(size_t(len) < sizeof(sahara::packet::Hello)) {
+            ensure(dev.read_struct(buf.data() + len, sizeof(sahara::packet::Hello) - len), "failed to receive hello command");
+        }
+        return State::SaharaHello;
+    }
+    drain(dev);
+    return header.command < sahara::Command::Limit ? State::Sahara : State::Unknown;
+}
+
+auto upload(Device& dev) -> bool {
+    struct stat st;
+    if(stat(config::loader_dir, &st) == 0 && S_ISDIR(st.st_mode)) {
+        return do_upload_from_library(dev, config::loader_dir, true);
+    }
+    return do_upload_hello(dev, "loader.bin", true);
+}
+
+// a single nop is sent and its answer awaited while the uploaded programmer boots,
+// repeating it would leave answers behind that the configure could take as its own
+auto wait_for_programmer(Device& dev) -> bool {
+    ensure(dev.write(nop.data(), nop.size()), "failed to send nop");
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(config::attach_boot_ms);
+    while(std::chrono::steady_clock::now() < deadline) {
+        if(dev.wait_readable(config::attach_probe_ms)) {
+            unwrap(state, receive_state(dev));
+            ensure(state == State::Firehose, "unexpected response from the uploaded programmer");
+            return true;
+        }
+    }
+    bail("programmer did not start within {}ms", config::attach_boot_ms);
+}
+} // namespace
+
+auto probe(Device& dev) -> std::optional<State> {
+    // a freshly plugged device sends its hello by itself
+    if(dev.wait_readable(config::attach_probe_ms)) {
+        unwrap(state, receive_state(dev));
+        if(state == State::SaharaHello) {
+            return state;
+        }
+    }
+
+    // a running programmer answers nop, sahara rejects it
+    ensure(dev.write(nop.data(), nop.size()), "failed to send nop");
+    ensure(dev.wait_readable(config::attach_probe_ms), "device does not respond, replug it");
+    unwrap(state, receive_state(dev));
+    if(state == State::SaharaHello || state == State::Firehose) {
+        return state;
+    }
+
+    // ask sahara to start over with a new hello
+    ensure(state == State::Sahara, "unknown link state, replug the device");
+    ensure(do_switchmode(dev, sahara::Mode::ImageTxPending));
+    ensure(dev.wait_readable(config::attach_probe_ms), "sahara did not restart, replug the device");
+    unwrap(restarted, receive_state(dev));
+    ensure(restarted == State::SaharaHello, "sahara did not restart, replug the device");
+    return restarted;
+}
+
+auto run(Device& dev) -> bool {
+    unwrap(state, probe(dev));
+    if(state == State::SaharaHello) {
+        std::println("sahara is waiting, uploading programmer");
+        ensure(upload(dev));
+        ensure(wait_for_programmer(dev));
+        return fh::send_configure(dev);
+    }
+
+    // a programmer left by an earlier session rejects getstorageinfo until configured
+    if(fh::load_storage_info(dev)) {
+        std::println("programmer is already configured");
+        return true;
+    }
+    std::println("configuring programmer");
+    drain(dev);
+    return fh::send_configure(dev);
+}
+} // namespace attach
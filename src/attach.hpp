@@ -0,0 +1,22 @@
+#pragma once
+#include <optional>
+
+#include "abstract-device.hpp"
+
+// brings a device from whatever state an earlier session left it in to a configured firehose session
+// the link is probed with short timeouts (config::attach_probe_ms) and only the missing steps run:
+//   sahara waiting for hello response: upload, configure
+//   programmer running: getstorageinfo, configure if the programmer rejects it
+namespace attach {
+enum class State {
+    SaharaHello, // sahara waits for the hello response, the hello itself was consumed
+    Sahara,      // sahara sent something else, e.g. an error after receiving a nop
+    Firehose,    // a programmer is running
+    Unknown,
+};
+
+// returns SaharaHello or Firehose
+auto probe(Device& dev) -> std::optional<State>;
+// the programmer is taken from config::loader_dir if it exists, ./loader.bin otherwise
+auto run(Device& dev) -> bool;
+} // namespace attach
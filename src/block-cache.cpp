@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <format>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "block-cache.hpp"
+#include "firehose-actions.hpp"
+#include "macros/assert.hpp"
+#include "sha256.hpp"
+
+namespace {
+constexpr auto magic             = std::array{'E', 'D', 'L', 'B', 'C', '0', '0', '1'};
+constexpr auto sample_count      = 8uz;
+constexpr auto sample_max_blocks = 256uz;
+
+struct MapHeader {
+    std::array<char, 8> magic;
+    uint64_t            block_size;
+    uint64_t            block_count;
+};
+
+struct Run {
+    size_t begin;
+    size_t end;
+};
+} // namespace
+
+auto BlockCache::test(const size_t block) const -> bool {
+    return bitmap[block / 8] & (1 << (block % 8));
+}
+
+auto BlockCache::set(const size_t block, const bool value) -> void {
+    if(value) {
+        bitmap[block / 8] |= 1 << (block % 8);
+    } else {
+        bitmap[block / 8] &= ~(1 << (block % 8));
+    }
+    dirty = true;
+}
+
+auto BlockCache::open(const std::string_view dir, const std::string_view serial, const int disk, const size_t block_size) -> bool {
+    const auto base = std::format("{}/{}-{}", dir, serial, disk);
+    data_fd         = FileDescriptor(::open((base + ".img").data(), O_RDWR | O_CREAT, 0644));
+    ensure(data_fd.as_handle() >= 0, "failed to open cache data errno={}({})", errno, strerror(errno));
+    map_fd = FileDescriptor(::open((base + ".map").data(), O_RDWR | O_CREAT, 0644));
+    ensure(map_fd.as_handle() >= 0, "failed to open cache map errno={}({})", errno, strerror(errno));
+
+    this->block_size  = block_size;
+    this->block_count = 0;
+
+    auto header = MapHeader();
+    if(pread(map_fd.as_handle(), &header, sizeof(header), 0) != sizeof(header) ||
+       header.magic != magic || header.block_size != block_size) {
+        std::println("cache {} is empty", base);
+        return true;
+    }
+    bitmap.resize((header.block_count + 7) / 8);
+    ensure(pread(map_fd.as_handle(), bitmap.data(), bitmap.size(), sizeof(header)) == ssize_t(bitmap.size()), "cache map truncated");
+    block_count = header.block_count;
+    std::println("cache {} loaded, {} blocks", base, block_count);
+    return true;
+}
+
+auto BlockCache::reset(const size_t block_count) -> bool {
+    // truncate to zero first so that stale data does not occupy the disk
+    ensure(ftruncate(data_fd.as_handle(), 0) == 0);
+    ensure(ftruncate(data_fd.as_handle(), block_count * block_size) == 0);
+    bitmap.assign((block_count + 7) / 8, 0);
+    this->block_count = block_count;
+    dirty             = true;
+    ensure(sync());
+    return true;
+}
+
+auto BlockCache::validate(Device& dev, const int disk) -> bool {
+    auto runs = std::vector<Run>();
+    for(auto block = 0uz; block < block_count; block += 1) {
+        if(!test(block)) {
+            continue;
+        }
+        if(!runs.empty() && runs.back().end == block) {
+            runs.back().end += 1;
+        } else {
+            runs.push_back(Run{block, block + 1});
+        }
+    }
+    if(runs.empty()) {
+        return true;
+    }
+
+    // always check the first run (gpt) and spread the others over the device
+    auto buf = std::vector<std::byte>(sample_max_blocks * block_size);
+    for(auto i = 0uz; i < sample_count && i < runs.size(); i += 1) {
+        const auto& run    = runs[i * runs.size() / std::min(sample_count, runs.size())];
+        const auto  blocks = std::min(run.end - run.begin, sample_max_blocks);
+        ensure(read(run.begin, blocks, buf.data()));
+        const auto host   = sha256::digest({buf.data(), blocks * block_size});
+        const auto remote = fh::get_sha256_digest(dev, disk, run.begin, blocks);
+        ensure(remote, "failed to get device digest");
+        ensure(*remote == host, "cache mismatch at block {}+{}", run.begin, blocks);
+    }
+    return true;
+}
+
+auto BlockCache::contains(const size_t block, const size_t blocks) const -> bool {
+    for(auto i = block; i < block + blocks; i += 1) {
+        if(!test(i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+auto BlockCache::find_missing(const size_t block, const size_t blocks) const -> std::pair<size_t, size_t> {
+    const auto end   = block + blocks;
+    auto       begin = block;
+    while(begin < end && test(begin)) {
+        // whole bytes of cached blocks are skipped at once
+        begin = begin % 8 == 0 && bitmap[begin / 8] == 0xff ? begin + 8 : begin + 1;
+    }
+    begin = std::min(begin, end);
+    auto last = begin;
+    while(last < end && !test(last)) {
+        last += 1;
+    }
+    return {begin, last - begin};
+}
+
+auto BlockCache::read(const size_t block, const size_t blocks, void* const buf) -> bool {
+    const auto len = blocks * block_size;
+    ensure(pread(data_fd.as_handle(), buf, len, block * block_size) == ssize_t(len), "cache read failed");
+    return true;
+}
+
+auto BlockCache::store(const size_t block, const size_t blocks, const void* const buf) -> bool {
+    const auto len = blocks * block_size;
+    ensure(pwrite(data_fd.as_handle(), buf, len, block * block_size) == ssize_t(len), "cache write failed");
+    for(auto i = block; i < block + blocks; i += 1) {
+        set(i, true);
+    }
+    return true;
+}
+
+auto BlockCache::invalidate(const size_t block, const size_t blocks) -> void {
+    for(auto i = block; i < block + blocks; i += 1) {
+        set(i, false);
+    }
+}
+
+auto BlockCache::sync() -> bool {
+    if(!dirty) {
+        return true;
+    }
+    // the data file is written before the map, so a crash can only lose entries
+    ensure(fdatasync(data_fd.as_handle()) == 0);
+    const auto header = MapHeader{magic, block_size, block_count};
+    ensure(pwrite(map_fd.as_handle(), &header, sizeof(header), 0) == sizeof(header));
+    ensure(pwrite(map_fd.as_handle(), bitmap.data(), bitmap.size(), sizeof(header)) == ssize_t(bitmap.size()));
+    ensure(ftruncate(map_fd.as_handle(), sizeof(header) + bitmap.size()) == 0);
+    dirty = false;
+    return true;
+}
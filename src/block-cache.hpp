@@ -0,0 +1,35 @@
+#pragma once
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "abstract-device.hpp"
+#include "util/fd.hpp"
+
+// persistent sparse copy of a lun, keyed by chip serial and lun number
+// the data file holds block contents at their natural offsets, the map file records which blocks are valid
+class BlockCache {
+  private:
+    FileDescriptor       data_fd;
+    FileDescriptor       map_fd;
+    std::vector<uint8_t> bitmap;
+    bool                 dirty = false;
+
+    auto test(size_t block) const -> bool;
+    auto set(size_t block, bool value) -> void;
+
+  public:
+    size_t block_size  = 0;
+    size_t block_count = 0; // 0 if the cache is new
+
+    auto open(std::string_view dir, std::string_view serial, int disk, size_t block_size) -> bool;
+    auto reset(size_t block_count) -> bool;
+    auto validate(Device& dev, int disk) -> bool;
+    auto contains(size_t block, size_t blocks) const -> bool;
+    // {begin, blocks} of the first run of missing blocks in block..block+blocks, blocks = 0 if none is missing
+    auto find_missing(size_t block, size_t blocks) const -> std::pair<size_t, size_t>;
+    auto read(size_t block, size_t blocks, void* buf) -> bool;
+    auto store(size_t block, size_t blocks, const void* buf) -> bool;
+    auto invalidate(size_t block, size_t blocks) -> void;
+    auto sync() -> bool;
+};
@@ -0,0 +1,191 @@
+#include <array>
+#include <atomic>
+#include <bit>
+#include <mutex>
+#include <utility>
+
+#include <sys/mman.h>
+
+#include "buffer-pool.hpp"
+#include "config.hpp"
+
+namespace pool {
+namespace {
+constexpr auto page_bytes      = 4096uz;
+constexpr auto huge_page_bytes = 2uz * 1024 * 1024;
+constexpr auto min_class_bits  = 12uz; // 4KiB
+constexpr auto num_classes     = 15uz; // up to 64MiB
+constexpr auto max_slots       = 256uz; // buffers per size class
+constexpr auto slab_bytes      = huge_page_bytes;
+
+auto align_up(const size_t value, const size_t align) -> size_t {
+    return (value + align - 1) / align * align;
+}
+
+auto map_length(const size_t bytes) -> size_t {
+    return align_up(std::max(bytes, page_bytes), bytes >= huge_page_bytes ? huge_page_bytes : page_bytes);
+}
+
+auto map(const size_t bytes) -> std::byte* {
+    const auto len        = map_length(bytes);
+    const auto huge       = len % huge_page_bytes == 0;
+    const auto prot       = PROT_READ | PROT_WRITE;
+    const auto flags      = MAP_PRIVATE | MAP_ANONYMOUS;
+    const auto huge_flags = flags | MAP_HUGETLB | (config::populate_buffers ? MAP_POPULATE : 0);
+    // explicitly reserved hugepages, usually there are none
+    if(huge && config::hugepage_buffers) {
+        if(const auto p = mmap(nullptr, len, prot, huge_flags, -1, 0); p != MAP_FAILED) {
+            return static_cast<std::byte*>(p);
+        }
+    }
+
+    // over-map so that the buffer starts on a hugepage boundary and transparent hugepages can back all of it
+    const auto align   = huge ? huge_page_bytes : page_bytes;
+    const auto raw_len = len + align - page_bytes;
+    const auto raw     = mmap(nullptr, raw_len, prot, flags, -1, 0);
+    if(raw == MAP_FAILED) {
+        return nullptr;
+    }
+    const auto head = align_up(std::bit_cast<uintptr_t>(raw), align) - std::bit_cast<uintptr_t>(raw);
+    const auto p    = static_cast<std::byte*>(raw) + head;
+    if(head != 0) {
+        munmap(raw, head);
+    }
+    if(const auto tail = raw_len - head - len; tail != 0) {
+        munmap(p + len, tail);
+    }
+    if(huge && config::hugepage_buffers) {
+        madvise(p, len, MADV_HUGEPAGE);
+    }
+    if(config::populate_buffers) {
+#ifdef MADV_POPULATE_WRITE
+        if(madvise(p, len, MADV_POPULATE_WRITE) == 0) {
+            return p;
+        }
+#endif
+        for(auto i = 0uz; i < len; i += page_bytes) {
+            p[i] = std::byte(0);
+        }
+    }
+    return p;
+}
+
+// treiber stack of slot indices, the head carries a tag against aba
+struct SizeClass {
+    static constexpr auto empty = uint32_t(0); // slot + 1 is stored, so that 0 means empty
+
+    std::array<std::byte*, max_slots>            buffers = {};
+    std::array<std::atomic<uint32_t>, max_slots> next    = {};
+    std::atomic<uint64_t>                        head    = empty;
+    size_t                                       created = 0; // guarded by grow_lock
+    std::mutex                                   grow_lock;
+
+    auto push(const uint32_t slot) -> void {
+        auto old = head.load(std::memory_order_relaxed);
+        while(true) {
+            next[slot].store(uint32_t(old), std::memory_order_relaxed);
+            const auto desired = ((old >> 32) + 1) << 32 | (slot + 1);
+            if(head.compare_exchange_weak(old, desired, std::memory_order_release, std::memory_order_relaxed)) {
+                return;
+            }
+        }
+    }
+
+    auto pop() -> uint32_t {
+        auto old = head.load(std::memory_order_acquire);
+        while(true) {
+            const auto top = uint32_t(old);
+            if(top == empty) {
+                return Buffer::no_slot;
+            }
+            const auto desired = ((old >> 32) + 1) << 32 | next[top - 1].load(std::memory_order_relaxed);
+            if(head.compare_exchange_weak(old, desired, std::memory_order_acquire, std::memory_order_acquire)) {
+                return top - 1;
+            }
+        }
+    }
+
+    // maps a slab holding one or more buffers, keeps the first one for the caller
+    auto grow(const size_t buffer_bytes) -> uint32_t {
+        auto l = std::unique_lock(grow_lock);
+        // another thread may have grown the class meanwhile
+        if(const auto slot = pop(); slot != Buffer::no_slot) {
+            return slot;
+        }
+        const auto count = std::min(std::max(slab_bytes / buffer_bytes, 1uz), max_slots - created);
+        if(count == 0) {
+            return Buffer::no_slot;
+        }
+        const auto slab = map(buffer_bytes * count);
+        if(slab == nullptr) {
+            return Buffer::no_slot;
+        }
+        const auto first = uint32_t(created);
+        for(auto i = 0uz; i < count; i += 1) {
+            buffers[first + i] = slab + i * buffer_bytes;
+        }
+        created += count;
+        for(auto i = 1uz; i < count; i += 1) {
+            push(first + i);
+        }
+        return first;
+    }
+};
+
+auto classes = std::array<SizeClass, num_classes>();
+
+auto get_class(const size_t bytes) -> size_t {
+    return std::bit_width(std::max(bytes, page_bytes) - 1) - min_class_bits;
+}
+} // namespace
+
+auto Buffer::release() -> void {
+    if(ptr == nullptr) {
+        return;
+    }
+    if(slot == no_slot) {
+        munmap(ptr, map_length(bytes));
+    } else {
+        classes[size_class].push(slot);
+    }
+    ptr = nullptr;
+}
+
+Buffer::Buffer(std::byte* const ptr, const size_t bytes, const uint32_t size_class, const uint32_t slot)
+    : ptr(ptr), bytes(bytes), size_class(size_class), slot(slot) {}
+
+Buffer::Buffer(Buffer&& o)
+    : ptr(std::exchange(o.ptr, nullptr)), bytes(o.bytes), size_class(o.size_class), slot(o.slot) {}
+
+auto Buffer::operator=(Buffer&& o) -> Buffer& {
+    if(this != &o) {
+        release();
+        ptr        = std::exchange(o.ptr, nullptr);
+        bytes      = o.bytes;
+        size_class = o.size_class;
+        slot       = o.slot;
+    }
+    return *this;
+}
+
+Buffer::~Buffer() {
+    release();
+}
+
+auto acquire(const size_t bytes) -> Buffer {
+    const auto index = get_class(bytes);
+    if(index < num_classes) {
+        auto& size_class = classes[index];
+        auto  slot       = size_class.pop();
+        if(slot == Buffer::no_slot) {
+            slot = size_class.grow(page_bytes << index);
+        }
+        if(slot != Buffer::no_slot) {
+            return Buffer(size_class.buffers[slot], bytes, uint32_t(index), slot);
+        }
+    }
+    // too large or the class is exhausted
+    const auto p = map(bytes);
+    return p == nullptr ? Buffer() : Buffer(p, bytes, 0, Buffer::no_slot);
+}
+} // namespace pool
@@ -0,0 +1,51 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// process-wide pool of page aligned transfer buffers
+// buffers are carved from slabs mapped with transparent hugepages and populated up front,
+// grouped into power-of-two size classes from 4KiB to 64MiB
+// acquire/release are lock-free, the pool only takes a lock when a size class has to map a new slab
+// slabs are never unmapped, so a steady-state transfer does no allocation at all
+namespace pool {
+// a buffer borrowed from the pool, returned when destroyed
+class Buffer {
+  private:
+    std::byte* ptr        = nullptr;
+    size_t     bytes      = 0;
+    uint32_t   size_class = 0;
+    uint32_t   slot       = 0; // unpooled if no_slot
+
+    auto release() -> void;
+
+  public:
+    static constexpr auto no_slot = uint32_t(-1);
+
+    auto data() const -> std::byte* {
+        return ptr;
+    }
+
+    auto size() const -> size_t {
+        return bytes;
+    }
+
+    auto span() const -> std::span<std::byte> {
+        return {ptr, bytes};
+    }
+
+    auto empty() const -> bool {
+        return ptr == nullptr;
+    }
+
+    Buffer() = default;
+    Buffer(std::byte* ptr, size_t bytes, uint32_t size_class, uint32_t slot);
+    Buffer(Buffer&& o);
+    auto operator=(Buffer&& o) -> Buffer&;
+    ~Buffer();
+};
+
+// returns an empty buffer if memory could not be mapped
+// contents are unspecified, a reused buffer keeps the data of its previous user
+auto acquire(size_t bytes) -> Buffer;
+} // namespace pool
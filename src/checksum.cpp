@@ -0,0 +1,146 @@
+#include <format>
+#include <fstream>
+
+#include <sys/stat.h>
+
+#include "checksum.hpp"
+#include "macros/unwrap.hpp"
+#include "util/charconv.hpp"
+#include "util/split.hpp"
+
+namespace checksum {
+namespace {
+// bounds the memory used when the hasher falls behind
+constexpr auto max_queued_bytes = 64uz * 1024 * 1024;
+} // namespace
+
+auto Stream::hasher_main() -> void {
+    auto ctx    = sha256::Context();
+    auto filled = 0uz;
+    while(true) {
+        auto l = std::unique_lock(lock);
+        cond.wait(l, [this] { return !queue.empty() || finished; });
+        if(queue.empty()) {
+            break;
+        }
+        auto data = std::move(queue.front());
+        queue.pop_front();
+        l.unlock();
+
+        auto rest = std::span<const std::byte>(data);
+        while(!rest.empty()) {
+            const auto len = std::min(rest.size(), chunk_bytes - filled);
+            ctx.update(rest.first(len));
+            rest = rest.subspan(len);
+            filled += len;
+            if(filled == chunk_bytes) {
+                digests.push_back(ctx.finish());
+                ctx    = sha256::Context();
+                filled = 0;
+            }
+        }
+
+        l.lock();
+        queued_bytes -= data.size();
+        free_buffers.push_back(std::move(data));
+        cond.notify_all();
+    }
+    if(filled != 0) {
+        digests.push_back(ctx.finish());
+    }
+}
+
+auto Stream::stop() -> void {
+    {
+        auto l   = std::unique_lock(lock);
+        finished = true;
+        cond.notify_all();
+    }
+    if(hasher.joinable()) {
+        hasher.join();
+    }
+}
+
+auto Stream::start(const size_t chunk_bytes) -> void {
+    this->chunk_bytes = chunk_bytes;
+    hasher            = std::thread(&Stream::hasher_main, this);
+}
+
+auto Stream::update(const std::span<const std::byte> data) -> void {
+    auto l = std::unique_lock(lock);
+    cond.wait(l, [this] { return queued_bytes < max_queued_bytes; });
+    auto buf = std::vector<std::byte>();
+    if(!free_buffers.empty()) {
+        buf = std::move(free_buffers.back());
+        free_buffers.pop_back();
+    }
+    l.unlock();
+    buf.assign(data.begin(), data.end());
+    l.lock();
+    queued_bytes += buf.size();
+    queue.push_back(std::move(buf));
+    cond.notify_all();
+}
+
+auto Stream::finish() -> std::vector<sha256::Digest> {
+    stop();
+    return std::move(digests);
+}
+
+Stream::~Stream() {
+    stop();
+}
+
+auto can_have_sidecar(const std::string_view path) -> bool {
+    if(path.starts_with("|")) {
+        return false;
+    }
+    // a manifest that does not exist yet becomes a regular file
+    struct stat st;
+    return stat(std::string(path).data(), &st) != 0 || S_ISREG(st.st_mode);
+}
+
+auto write_manifest(const std::string_view path, const Manifest& manifest) -> bool {
+    const auto sidecar = sidecar_path(path);
+    auto       file    = std::ofstream(sidecar + ".tmp");
+    ensure(file, "failed to create {}", sidecar);
+    file << "# disk sector_begin num_sectors chunk_sectors, then sha256 of each chunk\n";
+    file << std::format("{} {} {} {}\n", manifest.disk, manifest.sector_begin, manifest.num_sectors, manifest.chunk_sectors);
+    for(const auto& digest : manifest.digests) {
+        file << sha256::to_hex(digest) << '\n';
+    }
+    file.close();
+    ensure(file, "failed to write {}", sidecar);
+    ensure(rename((sidecar + ".tmp").data(), sidecar.data()) == 0);
+    return true;
+}
+
+auto read_manifest(const std::string_view path) -> std::optional<Manifest> {
+    const auto sidecar = sidecar_path(path);
+    auto       file    = std::ifstream(sidecar);
+    ensure(file, "failed to open {}", sidecar);
+
+    auto r    = Manifest();
+    auto line = std::string();
+    while(std::getline(file, line) && line.starts_with("#")) {
+    }
+    const auto elms = split(line, " ");
+    ensure(elms.size() == 4, "malformed {}", sidecar);
+    auto values = std::array<size_t, 4>();
+    for(auto i = 0uz; i < values.size(); i += 1) {
+        unwrap(value, from_chars<size_t>(elms[i]), "malformed {}", sidecar);
+        values[i] = value;
+    }
+    r.disk          = values[0];
+    r.sector_begin  = values[1];
+    r.num_sectors   = values[2];
+    r.chunk_sectors = values[3];
+    ensure(r.chunk_sectors != 0, "malformed {}", sidecar);
+    while(std::getline(file, line)) {
+        unwrap(digest, sha256::from_hex(line));
+        r.digests.push_back(digest);
+    }
+    ensure(r.digests.size() == (r.num_sectors + r.chunk_sectors - 1) / r.chunk_sectors, "truncated {}", sidecar);
+    return r;
+}
+} // namespace checksum
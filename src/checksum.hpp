@@ -0,0 +1,59 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "sha256.hpp"
+
+// per-chunk sha256 of transfers, comparable with the device side getsha256digest of the same sectors
+namespace checksum {
+// hashes a stream in fixed-size chunks on a helper thread, update() only copies the data
+class Stream {
+  private:
+    size_t                              chunk_bytes;
+    std::vector<sha256::Digest>         digests;
+    std::deque<std::vector<std::byte>>  queue;
+    std::vector<std::vector<std::byte>> free_buffers;
+    size_t                              queued_bytes = 0;
+    bool                                finished     = false;
+    std::mutex                          lock;
+    std::condition_variable             cond;
+    std::thread                         hasher;
+
+    auto hasher_main() -> void;
+    auto stop() -> void;
+
+  public:
+    auto start(size_t chunk_bytes) -> void;
+    auto update(std::span<const std::byte> data) -> void;
+    // includes the last partial chunk
+    auto finish() -> std::vector<sha256::Digest>;
+
+    ~Stream();
+};
+
+// sidecar file "<dump>.sha256"
+struct Manifest {
+    size_t                      disk;
+    size_t                      sector_begin;
+    size_t                      num_sectors;
+    size_t                      chunk_sectors;
+    std::vector<sha256::Digest> digests;
+};
+
+inline auto sidecar_path(const std::string_view path) -> std::string {
+    return std::string(path) + ".sha256";
+}
+
+// regular files only, pipes, fifos and devices like /dev/stdout have nowhere to put one
+auto can_have_sidecar(std::string_view path) -> bool;
+
+auto write_manifest(std::string_view path, const Manifest& manifest) -> bool;
+auto read_manifest(std::string_view path) -> std::optional<Manifest>;
+} // namespace checksum
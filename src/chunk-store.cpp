@@ -0,0 +1,255 @@
+#include <cstring>
+#include <format>
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "chunk-store.hpp"
+#include "config.hpp"
+#include "macros/unwrap.hpp"
+#include "util/charconv.hpp"
+#include "util/fd.hpp"
+#include "util/file-io.hpp"
+#include "util/split.hpp"
+
+namespace cas {
+namespace {
+auto is_zero(const std::byte* const data, const size_t size) -> bool {
+    return data[0] == std::byte(0) && memcmp(data, data + 1, size - 1) == 0;
+}
+
+auto store_dir(const std::string_view manifest_path) -> std::string {
+    const auto slash = manifest_path.rfind('/');
+    return std::string(slash == manifest_path.npos ? "." : manifest_path.substr(0, slash)) + "/chunks";
+}
+
+auto chunk_path(const std::string& store, const sha256::Digest& digest) -> std::string {
+    const auto hex = sha256::to_hex(digest);
+    return std::format("{}/{}/{}", store, hex.substr(0, 2), hex.substr(2));
+}
+
+auto make_dir(const std::string& path) -> bool {
+    ensure(mkdir(path.data(), 0755) == 0 || errno == EEXIST, "failed to create {} errno={}({})", path, errno, strerror(errno));
+    return true;
+}
+
+// makes the renames into a directory durable
+auto sync_dir(const std::string& path) -> bool {
+    const auto fd = FileDescriptor(open(path.data(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    ensure(fd.as_handle() >= 0, "failed to open {} errno={}({})", path, errno, strerror(errno));
+    ensure(fsync(fd.as_handle()) == 0, "failed to sync {} errno={}({})", path, errno, strerror(errno));
+    return true;
+}
+
+// returns whether the chunk was new
+// several backups may share a store, so chunks are written to a private name and renamed into place
+// the data is synced before the rename, a chunk under its digest name is complete even after a crash
+auto store_chunk(const std::string& store, const sha256::Digest& digest, const std::span<const std::byte> data) -> std::optional<bool> {
+    const auto path = chunk_path(store, digest);
+    if(access(path.data(), F_OK) == 0) {
+        return false;
+    }
+    const auto temp = std::format("{}.{}.tmp", path, gettid());
+    {
+        const auto fd = open(temp.data(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        ensure(fd >= 0, "failed to create {} errno={}({})", temp, errno, strerror(errno));
+        auto file = FileDescriptor(fd);
+        ensure(file.write(data.data(), data.size()), "failed to write chunk errno={}({})", errno, strerror(errno));
+        ensure(fdatasync(file.as_handle()) == 0, "failed to sync chunk errno={}({})", errno, strerror(errno));
+    }
+    ensure(rename(temp.data(), path.data()) == 0, "failed to store chunk errno={}({})", errno, strerror(errno));
+    return true;
+}
+} // namespace
+
+auto Writer::worker_main() -> void {
+    while(true) {
+        auto l = std::unique_lock(lock);
+        cond.wait(l, [this] { return !queue.empty() || finished || failed; });
+        if(queue.empty() || failed) {
+            break;
+        }
+        const auto chunk = queue.front();
+        queue.pop_front();
+        l.unlock();
+
+        const auto data   = std::span<const std::byte>(chunk->data.data(), chunk->size);
+        auto       digest = std::optional<sha256::Digest>();
+        auto       added  = std::optional<bool>(false);
+        if(!is_zero(data.data(), data.size())) {
+            digest = sha256::digest(data);
+            added  = store_chunk(store, *digest, data);
+        }
+
+        l.lock();
+        if(!added) {
+            failed = true;
+        } else {
+            digests[chunk->index] = digest;
+            if(*added) {
+                new_dirs[size_t((*digest)[0])] = true;
+            }
+            new_chunks += *added ? 1 : 0;
+            new_bytes += *added ? data.size() : 0;
+        }
+        free_chunks.push_back(chunk);
+        cond.notify_all();
+    }
+}
+
+auto Writer::stop() -> void {
+    {
+        auto l   = std::unique_lock(lock);
+        finished = true;
+        cond.notify_all();
+    }
+    for(auto& worker : workers) {
+        if(worker.joinable()) {
+            worker.join();
+        }
+    }
+}
+
+auto Writer::open(const std::string_view path, const size_t total_bytes) -> bool {
+    this->path  = path;
+    this->store = store_dir(path);
+    total       = total_bytes;
+    digests.resize((total + config::dedup_chunk_bytes - 1) / config::dedup_chunk_bytes);
+
+    ensure(make_dir(store));
+    for(auto i = 0; i < 0x100; i += 1) {
+        ensure(make_dir(std::format("{}/{:02x}", store, i)));
+    }
+
+    const auto threads = config::compress_threads != 0 ? config::compress_threads : std::max(1u, std::thread::hardware_concurrency());
+    chunks.resize(threads + 1);
+    for(auto& chunk : chunks) {
+        chunk.data.resize(config::dedup_chunk_bytes);
+        free_chunks.push_back(&chunk);
+    }
+    for(auto i = 0uz; i < threads; i += 1) {
+        workers.emplace_back(&Writer::worker_main, this);
+    }
+    return true;
+}
+
+auto Writer::acquire() -> std::span<std::byte> {
+    auto l = std::unique_lock(lock);
+    cond.wait(l, [this] { return !free_chunks.empty() || failed; });
+    if(failed) {
+        return {};
+    }
+    filling = free_chunks.back();
+    free_chunks.pop_back();
+    return filling->data;
+}
+
+auto Writer::commit(const size_t size) -> void {
+    auto l         = std::unique_lock(lock);
+    filling->index = next_index;
+    filling->size  = size;
+    next_index += 1;
+    queue.push_back(filling);
+    filling = nullptr;
+    cond.notify_all();
+}
+
+auto Writer::finish() -> bool {
+    stop();
+    ensure(!failed);
+    ensure(next_index == digests.size(), "dump is incomplete");
+    // the manifest must not refer to chunks whose names could still be lost
+    for(auto i = 0uz; i < new_dirs.size(); i += 1) {
+        ensure(!new_dirs[i] || sync_dir(std::format("{}/{:02x}", store, i)));
+    }
+    ensure(sync_dir(store));
+
+    auto file = std::ofstream(path + ".tmp");
+    ensure(file, "failed to create manifest");
+    file << std::format("edlm1 {} {}\n", config::dedup_chunk_bytes, total);
+    auto zero_chunks = 0uz;
+    for(const auto& digest : digests) {
+        file << (digest ? sha256::to_hex(*digest) : "zero") << '\n';
+        zero_chunks += digest ? 0 : 1;
+    }
+    file.close();
+    ensure(file, "failed to write manifest");
+    {
+        const auto fd = FileDescriptor(open((path + ".tmp").data(), O_RDONLY | O_CLOEXEC));
+        ensure(fd.as_handle() >= 0 && fdatasync(fd.as_handle()) == 0, "failed to sync manifest errno={}({})", errno, strerror(errno));
+    }
+    ensure(rename((path + ".tmp").data(), path.data()) == 0);
+    ensure(sync_dir(store.substr(0, store.rfind('/'))));
+    std::println("{} chunks, {} new ({} bytes), {} zero", digests.size(), new_chunks, new_bytes, zero_chunks);
+    return true;
+}
+
+Writer::~Writer() {
+    stop();
+}
+
+auto Reader::load_chunk(const size_t chunk) -> bool {
+    if(cached_chunk == chunk) {
+        return true;
+    }
+    const auto size = std::min(chunk_bytes, total_bytes - chunk * chunk_bytes);
+    if(const auto& digest = digests[chunk]; !digest) {
+        cache.assign(size, std::byte(0));
+    } else {
+        const auto path = chunk_path(store, *digest);
+        unwrap_mut(data, read_file(path), "missing chunk {}", path);
+        ensure(data.size() == size && sha256::digest(data) == *digest, "corrupted chunk {}", path);
+        cache = std::move(data);
+    }
+    cached_chunk = chunk;
+    return true;
+}
+
+auto Reader::open(const std::string_view path) -> bool {
+    store = store_dir(path);
+
+    auto file = std::ifstream(std::string(path));
+    ensure(file, "failed to open {}", path);
+    auto line = std::string();
+    ensure(std::getline(file, line), "empty manifest");
+    const auto elms = split(line, " ");
+    ensure(elms.size() == 3 && elms[0] == "edlm1", "not a manifest");
+    unwrap(chunk_bytes_v, from_chars<size_t>(elms[1]), "invalid chunk size");
+    unwrap(total_bytes_v, from_chars<size_t>(elms[2]), "invalid total size");
+    ensure(chunk_bytes_v != 0, "invalid chunk size");
+    chunk_bytes = chunk_bytes_v;
+    total_bytes = total_bytes_v;
+
+    while(std::getline(file, line)) {
+        if(line == "zero") {
+            digests.emplace_back(std::nullopt);
+        } else {
+            unwrap(digest, sha256::from_hex(line));
+            digests.emplace_back(digest);
+        }
+    }
+    ensure(digests.size() == (total_bytes + chunk_bytes - 1) / chunk_bytes, "truncated manifest");
+    return true;
+}
+
+auto Reader::get_total_bytes() const -> size_t {
+    return total_bytes;
+}
+
+auto Reader::read(size_t offset, size_t size, std::byte* buf) -> bool {
+    ensure(offset + size <= total_bytes, "read beyond the end of dump");
+    while(size > 0) {
+        const auto chunk      = offset / chunk_bytes;
+        const auto chunk_head = offset % chunk_bytes;
+        ensure(load_chunk(chunk));
+        const auto len = std::min(size, cache.size() - chunk_head);
+        memcpy(buf, cache.data() + chunk_head, len);
+        buf += len;
+        offset += len;
+        size -= len;
+    }
+    return true;
+}
+} // namespace cas
@@ -0,0 +1,81 @@
+#pragma once
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "sha256.hpp"
+
+// content-addressed backup store
+// a dump is split into fixed-size chunks, each unique chunk is stored once as chunks/xx/<sha256> next to the manifest
+// manifest: "edlm1 chunk_bytes total_bytes" followed by one line per chunk, either the hex digest or "zero"
+namespace cas {
+inline auto is_manifest_path(const std::string_view path) -> bool {
+    return path.ends_with(".edlm");
+}
+
+// hashes and stores chunks on a worker pool while the caller keeps filling new ones
+// has the same acquire/commit interface as FileWriter
+class Writer {
+  private:
+    struct Chunk {
+        size_t                 index;
+        std::vector<std::byte> data;
+        size_t                 size;
+    };
+
+    std::string                                 path;
+    std::string                                 store;
+    size_t                                      total;
+    std::vector<Chunk>                          chunks;
+    std::vector<Chunk*>                         free_chunks;
+    std::deque<Chunk*>                          queue;
+    Chunk*                                      filling    = nullptr;
+    size_t                                      next_index = 0;
+    std::vector<std::optional<sha256::Digest>> digests; // nullopt = all-zero chunk
+    size_t                                      new_chunks = 0;
+    size_t                                      new_bytes  = 0;
+    std::array<bool, 0x100>                     new_dirs   = {}; // chunks/xx directories that got new chunks
+    bool                                        finished   = false;
+    bool                                        failed     = false;
+    std::mutex                                  lock;
+    std::condition_variable                     cond;
+    std::vector<std::thread>                    workers;
+
+    auto worker_main() -> void;
+    auto stop() -> void;
+
+  public:
+    auto open(std::string_view path, size_t total_bytes) -> bool;
+    // returns an empty span if the writer failed
+    auto acquire() -> std::span<std::byte>;
+    auto commit(size_t size) -> void;
+    auto finish() -> bool;
+
+    ~Writer();
+};
+
+// random access to a stored dump, chunks are verified against their digest on load
+class Reader {
+  private:
+    std::string                                 store;
+    size_t                                      chunk_bytes;
+    size_t                                      total_bytes;
+    std::vector<std::optional<sha256::Digest>> digests;
+    std::vector<std::byte>                      cache;
+    size_t                                      cached_chunk = size_t(-1);
+
+    auto load_chunk(size_t chunk) -> bool;
+
+  public:
+    auto open(std::string_view path) -> bool;
+    auto get_total_bytes() const -> size_t;
+    auto read(size_t offset, size_t size, std::byte* buf) -> bool;
+};
+} // namespace cas
@@ -0,0 +1,251 @@
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zstd.h>
+
+#include "compressed-image.hpp"
+#include "config.hpp"
+#include "macros/assert.hpp"
+
+namespace edlz {
+namespace {
+auto write_all(const int fd, const void* const ptr, const size_t size, const uint64_t offset) -> bool {
+    auto done = 0uz;
+    while(done < size) {
+        const auto ret = pwrite(fd, static_cast<const std::byte*>(ptr) + done, size - done, offset + done);
+        if(ret < 0 && errno == EINTR) {
+            continue;
+        }
+        ensure(ret > 0, "failed to write image errno={}({})", errno, strerror(errno));
+        done += ret;
+    }
+    return true;
+}
+
+auto read_all(const int fd, void* const ptr, const size_t size, const uint64_t offset) -> bool {
+    ensure(pread(fd, ptr, size, offset) == ssize_t(size), "failed to read image errno={}({})", errno, strerror(errno));
+    return true;
+}
+
+auto is_zero(const std::byte* const data, const size_t size) -> bool {
+    return data[0] == std::byte(0) && memcmp(data, data + 1, size - 1) == 0;
+}
+
+auto compress_chunk(ZSTD_CCtx* const cctx, std::byte* const dst, const size_t dst_size, const std::byte* const src, const size_t src_size) -> std::optional<Entry> {
+    if(is_zero(src, src_size)) {
+        return Entry{0, 0, Kind::Hole};
+    }
+    const auto ret = ZSTD_compressCCtx(cctx, dst, dst_size, src, src_size, config::compress_level);
+    ensure(!ZSTD_isError(ret), "failed to compress chunk: {}", ZSTD_getErrorName(ret));
+    if(ret >= src_size) {
+        return Entry{0, uint32_t(src_size), Kind::Raw};
+    }
+    return Entry{0, uint32_t(ret), Kind::Zstd};
+}
+} // namespace
+
+auto Writer::worker_main() -> void {
+    const auto cctx = ZSTD_createCCtx();
+    while(true) {
+        auto l = std::unique_lock(lock);
+        cond.wait(l, [this] { return !queue.empty() || finished || failed; });
+        if(queue.empty() || failed) {
+            break;
+        }
+        const auto chunk = queue.front();
+        queue.pop_front();
+        l.unlock();
+
+        const auto entry = compress_chunk(cctx, chunk->compressed.data(), chunk->compressed.size(), chunk->data.data(), chunk->size);
+
+        l.lock();
+        if(!entry) {
+            failed = true;
+        } else {
+            chunk->entry       = *entry;
+            done[chunk->index] = chunk;
+        }
+        cond.notify_all();
+    }
+    ZSTD_freeCCtx(cctx);
+}
+
+auto Writer::writer_main() -> void {
+    for(auto written = 0uz;; written += 1) {
+        auto l = std::unique_lock(lock);
+        cond.wait(l, [this, written] { return done.contains(written) || (finished && written == next_index) || failed; });
+        if(!done.contains(written)) {
+            return;
+        }
+        const auto chunk = done[written];
+        done.erase(written);
+        l.unlock();
+
+        auto& entry = chunk->entry;
+        auto  ok    = true;
+        if(entry.kind != Kind::Hole) {
+            entry.offset = offset;
+            ok           = write_all(fd, entry.kind == Kind::Zstd ? chunk->compressed.data() : chunk->data.data(), entry.size, offset);
+            offset += entry.size;
+        }
+
+        l.lock();
+        failed |= !ok;
+        index.push_back(entry);
+        free_chunks.push_back(chunk);
+        cond.notify_all();
+    }
+}
+
+auto Writer::stop() -> void {
+    {
+        auto l   = std::unique_lock(lock);
+        finished = true;
+        cond.notify_all();
+    }
+    for(auto& worker : workers) {
+        if(worker.joinable()) {
+            worker.join();
+        }
+    }
+    if(writer.joinable()) {
+        writer.join();
+    }
+}
+
+auto Writer::open(const std::string_view path, const size_t total_bytes) -> bool {
+    fd = ::open(std::string(path).data(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ensure(fd >= 0, "failed to open {} errno={}({})", path, errno, strerror(errno));
+    offset = sizeof(Header);
+    total  = total_bytes;
+
+    const auto threads = config::compress_threads != 0 ? config::compress_threads : std::max(1u, std::thread::hardware_concurrency());
+    // enough chunks to keep every worker busy while one is filled and one is written
+    chunks.resize(threads + 2);
+    for(auto& chunk : chunks) {
+        chunk.data.resize(config::compress_chunk_bytes);
+        chunk.compressed.resize(ZSTD_compressBound(config::compress_chunk_bytes));
+        free_chunks.push_back(&chunk);
+    }
+    for(auto i = 0uz; i < threads; i += 1) {
+        workers.emplace_back(&Writer::worker_main, this);
+    }
+    writer = std::thread(&Writer::writer_main, this);
+    return true;
+}
+
+auto Writer::acquire() -> std::span<std::byte> {
+    auto l = std::unique_lock(lock);
+    cond.wait(l, [this] { return !free_chunks.empty() || failed; });
+    if(failed) {
+        return {};
+    }
+    filling = free_chunks.back();
+    free_chunks.pop_back();
+    return filling->data;
+}
+
+auto Writer::commit(const size_t size) -> void {
+    auto l         = std::unique_lock(lock);
+    filling->index = next_index;
+    filling->size  = size;
+    next_index += 1;
+    queue.push_back(filling);
+    filling = nullptr;
+    cond.notify_all();
+}
+
+auto Writer::finish() -> bool {
+    stop();
+    ensure(!failed);
+    const auto header  = Header{magic, config::compress_chunk_bytes, total};
+    const auto trailer = Trailer{offset, index.size(), magic};
+    ensure(write_all(fd, index.data(), index.size() * sizeof(Entry), offset));
+    ensure(write_all(fd, &trailer, sizeof(trailer), offset + index.size() * sizeof(Entry)));
+    ensure(write_all(fd, &header, sizeof(header), 0));
+    ensure(close(fd) == 0);
+    fd = -1;
+    std::println("compressed {} bytes to {} bytes", total, offset);
+    return true;
+}
+
+Writer::~Writer() {
+    stop();
+    if(fd >= 0) {
+        close(fd);
+    }
+}
+
+auto Reader::load_chunk(const size_t chunk) -> bool {
+    if(cached_chunk == chunk) {
+        return true;
+    }
+    const auto& entry = index[chunk];
+    const auto  size  = std::min(header.chunk_bytes, header.total_bytes - chunk * header.chunk_bytes);
+    cache.resize(size);
+    switch(entry.kind) {
+    case Kind::Hole:
+        std::fill(cache.begin(), cache.end(), std::byte(0));
+        break;
+    case Kind::Raw:
+        ensure(entry.size == size, "corrupted chunk {}", chunk);
+        ensure(read_all(fd, cache.data(), size, entry.offset));
+        break;
+    case Kind::Zstd: {
+        compressed.resize(entry.size);
+        ensure(read_all(fd, compressed.data(), entry.size, entry.offset));
+        const auto ret = ZSTD_decompress(cache.data(), cache.size(), compressed.data(), compressed.size());
+        ensure(!ZSTD_isError(ret) && ret == size, "corrupted chunk {}", chunk);
+    } break;
+    default:
+        bail("unknown chunk kind {}", std::to_underlying(entry.kind));
+    }
+    cached_chunk = chunk;
+    return true;
+}
+
+auto Reader::open(const std::string_view path) -> bool {
+    fd = ::open(std::string(path).data(), O_RDONLY);
+    ensure(fd >= 0, "failed to open {} errno={}({})", path, errno, strerror(errno));
+
+    struct stat st;
+    ensure(fstat(fd, &st) == 0);
+    ensure(size_t(st.st_size) >= sizeof(Header) + sizeof(Trailer), "not an image");
+    ensure(read_all(fd, &header, sizeof(header), 0));
+    ensure(header.magic == magic && header.chunk_bytes != 0, "not an image");
+    auto trailer = Trailer();
+    ensure(read_all(fd, &trailer, sizeof(trailer), st.st_size - sizeof(trailer)));
+    ensure(trailer.magic == magic, "image is not finished");
+    ensure(trailer.chunk_count == (header.total_bytes + header.chunk_bytes - 1) / header.chunk_bytes, "corrupted index");
+    index.resize(trailer.chunk_count);
+    ensure(read_all(fd, index.data(), index.size() * sizeof(Entry), trailer.index_offset));
+    return true;
+}
+
+auto Reader::get_total_bytes() const -> size_t {
+    return header.total_bytes;
+}
+
+auto Reader::read(size_t offset, size_t size, std::byte* buf) -> bool {
+    ensure(offset + size <= header.total_bytes, "read beyond the end of image");
+    while(size > 0) {
+        const auto chunk      = offset / header.chunk_bytes;
+        const auto chunk_head = offset % header.chunk_bytes;
+        ensure(load_chunk(chunk));
+        const auto len = std::min(size, cache.size() - chunk_head);
+        memcpy(buf, cache.data() + chunk_head, len);
+        buf += len;
+        offset += len;
+        size -= len;
+    }
+    return true;
+}
+
+Reader::~Reader() {
+    if(fd >= 0) {
+        close(fd);
+    }
+}
+} // namespace edlz
@@ -0,0 +1,109 @@
+#pragma once
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <span>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// seekable image format for dumps
+// the image is split into fixed-size chunks, each stored as an independent zstd frame, raw, or as a hole if all-zero
+// layout: Header, chunk data..., Entry[chunk_count], Trailer
+namespace edlz {
+constexpr auto magic = std::array{'E', 'D', 'L', 'Z', '0', '0', '0', '1'};
+
+enum class Kind : uint32_t {
+    Hole = 0,
+    Zstd = 1,
+    Raw  = 2,
+};
+
+struct Header {
+    std::array<char, 8> magic;
+    uint64_t            chunk_bytes;
+    uint64_t            total_bytes;
+};
+
+struct Entry {
+    uint64_t offset;
+    uint32_t size;
+    Kind     kind;
+};
+
+struct Trailer {
+    uint64_t            index_offset;
+    uint64_t            chunk_count;
+    std::array<char, 8> magic;
+};
+
+inline auto is_image_path(const std::string_view path) -> bool {
+    return path.ends_with(".edlz");
+}
+
+// compresses chunks on a worker pool while the caller keeps filling new ones
+// has the same acquire/commit interface as FileWriter
+class Writer {
+  private:
+    struct Chunk {
+        size_t                 index;
+        std::vector<std::byte> data;
+        size_t                 size;
+        std::vector<std::byte> compressed;
+        Entry                  entry;
+    };
+
+    int                      fd = -1;
+    uint64_t                 offset;
+    size_t                   total;
+    std::vector<Chunk>       chunks;
+    std::vector<Chunk*>      free_chunks;
+    std::deque<Chunk*>       queue;
+    std::map<size_t, Chunk*> done;
+    Chunk*                   filling    = nullptr;
+    size_t                   next_index = 0;
+    std::vector<Entry>       index;
+    bool                     finished = false;
+    bool                     failed   = false;
+    std::mutex               lock;
+    std::condition_variable  cond;
+    std::vector<std::thread> workers;
+    std::thread              writer;
+
+    auto worker_main() -> void;
+    auto writer_main() -> void;
+    auto stop() -> void;
+
+  public:
+    auto open(std::string_view path, size_t total_bytes) -> bool;
+    // returns an empty span if the writer failed
+    auto acquire() -> std::span<std::byte>;
+    auto commit(size_t size) -> void;
+    auto finish() -> bool;
+
+    ~Writer();
+};
+
+// random access to an image
+class Reader {
+  private:
+    int                    fd = -1;
+    Header                 header;
+    std::vector<Entry>     index;
+    std::vector<std::byte> compressed;
+    std::vector<std::byte> cache;
+    size_t                 cached_chunk = size_t(-1);
+
+    auto load_chunk(size_t chunk) -> bool;
+
+  public:
+    auto open(std::string_view path) -> bool;
+    auto get_total_bytes() const -> size_t;
+    auto read(size_t offset, size_t size, std::byte* buf) -> bool;
+
+    ~Reader();
+};
+} // namespace edlz
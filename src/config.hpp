@@ -3,5 +3,38 @@
 namespace config {
 inline auto dump_serial_io         = false;
 inline auto debug_firehose_disk_io = false;
+inline auto firehose_log_entries   = 256uz; // programmer logs kept until drained, 0 = only counted, see firehose-log.hpp
+inline auto quiet_transfers        = true; // lowers the programmer's verbosity during bulk reads, programs stay verbose
 inline auto disk_read_only         = false;
+inline auto memory_name            = ""; // "UFS", "eMMC" or "NAND", empty = probe in that order
+inline auto erase_unit_sectors     = 1uz; // discards and erased fill runs are aligned to this
+inline auto erase_fill_runs        = true; // 0x00/0xff runs are erased instead of programmed if erasing leaves the same bytes
+inline auto skip_fill_runs         = false; // fhwrite leaves them out altogether, the device must already hold them
+inline auto fill_run_min_bytes     = 1uz * 1024 * 1024;
+inline auto file_buffer_bytes      = 16uz * 1024 * 1024;
+inline auto nbd_merge_bytes        = 16uz * 1024 * 1024; // adjacent nbd requests are merged into commands up to this size
+inline auto file_buffers           = 2uz; // write-behind buffers for dumps
+inline auto prefetch_buffers       = 4uz; // read-ahead buffers for flashing
+inline auto direct_file_io         = false; // O_DIRECT for regular files
+inline auto hugepage_buffers       = true; // back pooled transfer buffers with hugepages, see buffer-pool.hpp
+inline auto populate_buffers       = true; // fault pooled buffers in when they are mapped
+inline auto compress_chunk_bytes   = 4uz * 1024 * 1024;
+inline auto compress_level         = 3;
+inline auto compress_threads       = 0u; // 0 = number of cpus, also used for hashing dedup chunks
+inline auto dedup_chunk_bytes      = 1uz * 1024 * 1024;
+inline auto checksum_dumps         = true; // writes a .sha256 sidecar next to dumps
+inline auto verify_writes          = true; // compares flashed data with device side digests, if the programmer supports them
+inline auto checksum_chunk_bytes   = 16uz * 1024 * 1024;
+inline auto journal_sync_chunks    = 8uz; // completed chunks recorded per journal sync
+inline auto scan_chunk_bytes       = 16uz * 1024 * 1024; // read at once by fhscan, bisected if it fails
+inline auto clone_chunk_bytes      = 4uz * 1024 * 1024; // read at once by buse --clone, a request waits for at most one
+inline auto clone_idle_ms          = 50; // nbd idle time before buse --clone reads from the device again
+inline auto autotune               = true; // sectors per read/program command, see transfer-tuner.hpp
+inline auto tune_latency_budget_ms = 1000.0;
+inline auto tune_probe_interval    = 64uz; // commands between probes of neighbouring sizes
+inline auto tune_profile_dir       = ""; // empty = $XDG_CACHE_HOME/edl-tune
+inline auto use_io_uring           = false; // serial backend, see uring-device.hpp
+inline auto loader_dir             = "loaders"; // loader library for autoupload, see loader-library.hpp
+inline auto attach_probe_ms        = 200; // how long attach waits for an answer, see attach.hpp
+inline auto attach_boot_ms         = 5000; // how long an uploaded programmer may take to start
 } // namespace config
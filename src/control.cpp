@@ -0,0 +1,186 @@
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <format>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <variant>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "config.hpp"
+#include "control.hpp"
+#include "firehose-log.hpp"
+#include "macros/unwrap.hpp"
+#include "util/charconv.hpp"
+#include "util/fd.hpp"
+
+namespace control {
+namespace {
+struct Knob {
+    std::string_view               name;
+    std::variant<bool*, size_t*> value;
+};
+
+// knobs read by the serving thread on every request
+const auto knobs = std::array{
+    Knob{"debug_firehose_disk_io", &config::debug_firehose_disk_io},
+    Knob{"dump_serial_io", &config::dump_serial_io},
+    Knob{"disk_read_only", &config::disk_read_only},
+    Knob{"autotune", &config::autotune},
+    Knob{"tune_probe_interval", &config::tune_probe_interval},
+    Knob{"erase_fill_runs", &config::erase_fill_runs},
+    Knob{"fill_run_min_bytes", &config::fill_run_min_bytes},
+    Knob{"erase_unit_sectors", &config::erase_unit_sectors},
+    Knob{"nbd_merge_bytes", &config::nbd_merge_bytes},
+};
+
+struct Change {
+    const Knob* knob;
+    size_t      value;
+};
+
+auto lock         = std::mutex(); // guards pending and writes to the knobs
+auto pending      = std::vector<Change>();
+auto has_pending  = std::atomic<bool>(false);
+auto last_sample  = std::chrono::steady_clock::now();
+auto last_read    = uint64_t(0);
+auto last_written = uint64_t(0);
+
+auto format_stats() -> std::string {
+    const auto now          = std::chrono::steady_clock::now();
+    const auto seconds      = std::chrono::duration<double>(now - last_sample).count();
+    const auto read_bytes   = stats.read_bytes.load();
+    const auto write_bytes  = stats.write_bytes.load();
+    const auto hits         = stats.cache_hit_blocks.load();
+    const auto misses       = stats.cache_miss_blocks.load();
+    const auto log          = fh::log::get_metrics();
+    const auto read_mib_s   = (read_bytes - last_read) / seconds / 1024 / 1024;
+    const auto write_mib_s  = (write_bytes - last_written) / seconds / 1024 / 1024;
+    const auto hit_rate     = hits + misses != 0 ? double(hits) / (hits + misses) : 0.0;
+    last_sample             = now;
+    last_read               = read_bytes;
+    last_written            = write_bytes;
+
+    auto r = std::string();
+    r += std::format("reads {}\nwrites {}\ntrims {}\nflushes {}\nerrors {}\n", stats.reads.load(), stats.writes.load(), stats.trims.load(), stats.flushes.load(), stats.errors.load());
+    r += std::format("read_bytes {}\nwrite_bytes {}\nread_mib_s {:.1f}\nwrite_mib_s {:.1f}\n", read_bytes, write_bytes, read_mib_s, write_mib_s);
+    r += std::format("cache_hit_blocks {}\ncache_miss_blocks {}\ncache_hit_rate {:.3f}\n", hits, misses, hit_rate);
+    r += std::format("clone_blocks {}\n", stats.clone_blocks.load());
+    r += std::format("queue_depth {}\nin_flight {}\n", stats.queue_depth.load(), stats.in_flight.load());
+    r += std::format("programmer_logs {}\nprogrammer_errors {}\n", log.logs, log.errors);
+    return r;
+}
+
+auto format_knobs() -> std::string {
+    auto l = std::unique_lock(lock);
+    auto r = std::string();
+    for(const auto& knob : knobs) {
+        std::visit([&](const auto ptr) { r += std::format("{} {}\n", knob.name, size_t(*ptr)); }, knob.value);
+    }
+    return r;
+}
+
+auto set_knob(const std::string_view args) -> std::string {
+    const auto space = args.find(' ');
+    if(space == args.npos) {
+        return "error usage: set NAME VALUE\n";
+    }
+    const auto name = args.substr(0, space);
+    const auto knob = std::ranges::find(knobs, name, &Knob::name);
+    if(knob == knobs.end()) {
+        return std::format("error unknown knob {}\n", name);
+    }
+    const auto value = from_chars<size_t>(args.substr(space + 1));
+    if(!value || (std::holds_alternative<bool*>(knob->value) && *value > 1)) {
+        return std::format("error invalid value {}\n", args.substr(space + 1));
+    }
+    auto l = std::unique_lock(lock);
+    pending.push_back(Change{&*knob, *value});
+    has_pending.store(true, std::memory_order_release);
+    return "ok\n";
+}
+
+auto execute(const std::string_view line) -> std::string {
+    if(line == "stats") {
+        return format_stats();
+    }
+    if(line == "get") {
+        return format_knobs();
+    }
+    if(line.starts_with("set ")) {
+        return set_knob(line.substr(4));
+    }
+    return "error unknown command, see control.hpp\n";
+}
+
+auto serve_client(FileDescriptor fd) -> void {
+    auto buf  = std::array<char, 1024>();
+    auto line = std::string();
+    while(true) {
+        const auto len = read(fd.as_handle(), buf.data(), buf.size());
+        if(len <= 0) {
+            return;
+        }
+        line.append(buf.data(), len);
+        for(auto pos = line.find('\n'); pos != line.npos; pos = line.find('\n')) {
+            auto command = std::string_view(line).substr(0, pos);
+            if(command.ends_with('\r')) {
+                command.remove_suffix(1);
+            }
+            const auto reply = execute(command) + "\n";
+            if(!fd.write(reply.data(), reply.size())) {
+                return;
+            }
+            line.erase(0, pos + 1);
+        }
+    }
+}
+
+auto listener_main(FileDescriptor listener) -> void {
+    while(true) {
+        auto fd = FileDescriptor(accept4(listener.as_handle(), nullptr, nullptr, SOCK_CLOEXEC));
+        if(fd.as_handle() < 0) {
+            if(errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            std::println("control socket accept failed errno={}({})", errno, strerror(errno));
+            return;
+        }
+        // one client at a time, the socket is for an operator
+        serve_client(std::move(fd));
+    }
+}
+} // namespace
+
+auto start(const std::string_view path) -> bool {
+    auto addr = sockaddr_un{.sun_family = AF_UNIX};
+    ensure(path.size() < sizeof(addr.sun_path), "socket path too long");
+    std::ranges::copy(path, addr.sun_path);
+    unlink(addr.sun_path);
+    auto fd = FileDescriptor(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    ensure(fd.as_handle() >= 0);
+    ensure(bind(fd.as_handle(), std::bit_cast<sockaddr*>(&addr), sizeof(addr)) == 0, "failed to bind {} errno={}({})", path, errno, strerror(errno));
+    ensure(listen(fd.as_handle(), 1) == 0);
+    std::thread(listener_main, std::move(fd)).detach();
+    std::println("control socket on {}", path);
+    return true;
+}
+
+auto apply_pending() -> void {
+    if(!has_pending.load(std::memory_order_acquire)) {
+        return;
+    }
+    auto l = std::unique_lock(lock);
+    for(const auto& change : pending) {
+        std::visit([&](const auto ptr) { *ptr = std::remove_reference_t<decltype(*ptr)>(change.value); }, change.knob->value);
+        std::println("control: {} = {}", change.knob->name, change.value);
+    }
+    pending.clear();
+    has_pending.store(false, std::memory_order_relaxed);
+}
+} // namespace control
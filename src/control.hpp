@@ -0,0 +1,34 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string_view>
+
+// control socket of a running edl-buse
+// one command per line, answered with "key value" lines and an empty line:
+//   stats            counters since start, throughput since the previous stats
+//   get              current values of the knobs
+//   set NAME VALUE   changes a knob, it takes effect before the next request
+namespace control {
+struct Stats {
+    std::atomic<uint64_t> reads;
+    std::atomic<uint64_t> writes;
+    std::atomic<uint64_t> trims;
+    std::atomic<uint64_t> flushes;
+    std::atomic<uint64_t> errors;
+    std::atomic<uint64_t> read_bytes;
+    std::atomic<uint64_t> write_bytes;
+    std::atomic<uint64_t> cache_hit_blocks;  // reads served by the block cache
+    std::atomic<uint64_t> cache_miss_blocks; // reads sent to the device while a cache is in use
+    std::atomic<uint64_t> clone_blocks;      // copied by the lazy clone, see lazy-clone.hpp
+    std::atomic<uint64_t> queue_depth;       // requests received by the nbd server and not replied yet
+    std::atomic<uint64_t> in_flight;         // requests being served by the block operator
+};
+
+inline auto stats = Stats();
+
+// serves the socket on a background thread
+auto start(std::string_view path) -> bool;
+// called by the serving thread between requests, applies changes made by "set"
+// config values are only written here, so that the serving thread never sees them change mid-request
+auto apply_pending() -> void;
+} // namespace control
@@ -0,0 +1,25 @@
+#include <array>
+
+#include "crc32.hpp"
+
+namespace {
+constexpr auto table = [] {
+    auto r = std::array<uint32_t, 256>();
+    for(auto i = 0u; i < r.size(); i += 1) {
+        auto c = i;
+        for(auto j = 0; j < 8; j += 1) {
+            c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        }
+        r[i] = c;
+    }
+    return r;
+}();
+} // namespace
+
+auto crc32(const std::span<const std::byte> data, uint32_t crc) -> uint32_t {
+    crc = ~crc;
+    for(const auto b : data) {
+        crc = table[(crc ^ uint32_t(b)) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
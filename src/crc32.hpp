@@ -0,0 +1,6 @@
+#pragma once
+#include <cstdint>
+#include <span>
+
+// crc32 used by gpt (ieee 802.3, reflected)
+auto crc32(std::span<const std::byte> data, uint32_t crc = 0) -> uint32_t;
@@ -1,73 +1,360 @@
-#include <array>
+#include <cstring>
+#include <vector>
 
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/nbd.h>
+#include <sys/ioctl.h>
+
+#include "attach.hpp"
+#include "block-cache.hpp"
 #include "buse/block-operator.hpp"
 #include "buse/buse.hpp"
+#include "config.hpp"
+#include "control.hpp"
 #include "firehose-actions.hpp"
+#include "lazy-clone.hpp"
 #include "macros/unwrap.hpp"
+#include "nbd-server.hpp"
+#include "overlay.hpp"
 #include "serial-device.hpp"
 #include "util/charconv.hpp"
+#include "util/fd.hpp"
 
 namespace {
 struct EDLOperator : buse::BlockOperator {
-    Device* dev;
-    int     disk;
+    Device*       dev;
+    int           disk;
+    BlockCache*   cache   = nullptr;
+    Overlay*      overlay = nullptr;
+    lazy::Copier* copier  = nullptr; // cache is a lazy clone
 
-    auto read_block(const size_t block, const size_t blocks, void* buf) -> bool override {
-        ensure(fh::read_disk(*dev, disk, block, blocks, std::bit_cast<std::byte*>(buf)));
+    // pending discard range in blocks, adjacent trims are merged into it
+    size_t trim_begin = 0;
+    size_t trim_end   = 0;
+
+    auto flush_trim() -> bool {
+        if(trim_begin == trim_end) {
+            return true;
+        }
+        const auto unit  = config::erase_unit_sectors;
+        const auto begin = (trim_begin + unit - 1) / unit * unit;
+        const auto end   = trim_end / unit * unit;
+        if(begin < end) {
+            // the range stays pending when the erase fails, so that a later flush retries it
+            ensure(fh::erase_disk(*dev, disk, begin, end - begin));
+            if(cache != nullptr) {
+                cache->invalidate(begin, end - begin);
+            }
+        }
+        trim_begin = trim_end = 0;
         return true;
     }
 
-    auto write_block(size_t block, size_t blocks, const void* buf) -> bool override {
-        ensure(fh::write_disk(*dev, disk, block, blocks, std::bit_cast<std::byte*>(buf)));
+    auto flush_trim_if_overlap(const size_t block, const size_t blocks) -> bool {
+        if(block < trim_end && trim_begin < block + blocks) {
+            ensure(flush_trim());
+        }
+        return true;
+    }
+
+    auto read_base(const size_t block, const size_t blocks, std::byte* const buf) -> bool {
+        ensure(flush_trim_if_overlap(block, blocks));
+        if(cache == nullptr) {
+            ensure(fh::read_disk(*dev, disk, block, blocks, buf));
+            return true;
+        }
+        // cached runs are served from the cache and only the missing ones are read from the device
+        // cached blocks are never stored over, in a clone they may hold writes the device does not have
+        const auto end = block + blocks;
+        for(auto next = block; next < end;) {
+            const auto [missing, count] = cache->find_missing(next, end - next);
+            if(missing > next) {
+                ensure(cache->read(next, missing - next, buf + (next - block) * cache->block_size));
+                control::stats.cache_hit_blocks += missing - next;
+            }
+            if(count == 0) {
+                break;
+            }
+            ensure(copier == nullptr || !copier->is_done(), "blocks {}+{} could not be cloned", missing, count);
+            const auto ptr = buf + (missing - block) * cache->block_size;
+            ensure(fh::read_disk(*dev, disk, missing, count, ptr));
+            ensure(cache->store(missing, count, ptr));
+            control::stats.cache_miss_blocks += count;
+            next = missing + count;
+        }
         return true;
     }
+
+    auto write_base(const size_t block, const size_t blocks, const std::byte* const buf) -> bool {
+        ensure(flush_trim_if_overlap(block, blocks));
+        // a clone takes the writes, the device is only read from
+        if(copier != nullptr) {
+            ensure(cache->store(block, blocks, buf));
+            return true;
+        }
+        // a failed write may have programmed or erased part of the range, the cached data is stale either way
+        if(cache != nullptr) {
+            cache->invalidate(block, blocks);
+        }
+        ensure(fh::write_disk(*dev, disk, block, blocks, buf));
+        if(cache != nullptr) {
+            ensure(cache->store(block, blocks, buf));
+        }
+        return true;
+    }
+
+    // the copier shares the device and the cache, requests take them ahead of it
+    template <class F>
+    auto exclusive(F f) -> decltype(f()) {
+        return copier != nullptr ? copier->run_request(f) : f();
+    }
+
+    // counts a request for the control socket, knob changes are applied between requests
+    // bytes are added to byte_counter only if the request succeeded
+    template <class F>
+    auto track(std::atomic<uint64_t>& counter, F f, std::atomic<uint64_t>* const byte_counter = nullptr, const size_t bytes = 0) -> decltype(f()) {
+        return exclusive([&] {
+            control::apply_pending();
+            counter += 1;
+            control::stats.in_flight += 1;
+            const auto r = f();
+            control::stats.in_flight -= 1;
+            // reads and writes report success, trims and flushes an errno
+            if(std::same_as<decltype(r), const bool> ? !r : r != 0) {
+                control::stats.errors += 1;
+            } else if(byte_counter != nullptr) {
+                *byte_counter += bytes;
+            }
+            return r;
+        });
+    }
+
+    auto read_block(const size_t block, const size_t blocks, void* buf) -> bool override {
+        const auto read = [&] { return read_overlay(block, blocks, std::bit_cast<std::byte*>(buf)); };
+        return track(control::stats.reads, read, &control::stats.read_bytes, blocks * block_size);
+    }
+
+    auto read_overlay(const size_t block, const size_t blocks, std::byte* const buf) -> bool {
+        if(overlay != nullptr) {
+            return overlay->read(block, blocks, buf, [this](const size_t block, const size_t blocks, std::byte* const buf) {
+                return read_base(block, blocks, buf);
+            });
+        }
+        return read_base(block, blocks, buf);
+    }
+
+    auto write_block(size_t block, size_t blocks, const void* buf) -> bool override {
+        const auto write = [&] { return write_overlay(block, blocks, std::bit_cast<const std::byte*>(buf)); };
+        return track(control::stats.writes, write, &control::stats.write_bytes, blocks * block_size);
+    }
+
+    auto write_overlay(const size_t block, const size_t blocks, const std::byte* const buf) -> bool {
+        if(overlay != nullptr) {
+            return overlay->write(block, blocks, buf);
+        }
+        return write_base(block, blocks, buf);
+    }
+
+    auto trim(const size_t from, const size_t len) -> int override {
+        return track(control::stats.trims, [&] { return trim_blocks(from, len); });
+    }
+
+    auto trim_blocks(const size_t from, const size_t len) -> int {
+        // discards must not reach the flash either, and the overlay has no way to record them
+        // a clone would copy the discarded blocks from the device again
+        if(overlay != nullptr || copier != nullptr) {
+            return 0;
+        }
+        // only blocks fully covered by the request can be discarded
+        const auto begin = (from + block_size - 1) / block_size;
+        const auto end   = (from + len) / block_size;
+        if(begin >= end) {
+            return 0;
+        }
+        if(begin == trim_end || end == trim_begin) {
+            trim_begin = std::min(trim_begin, begin);
+            trim_end   = std::max(trim_end, end);
+            return 0;
+        }
+        if(!flush_trim()) {
+            return EIO;
+        }
+        trim_begin = begin;
+        trim_end   = end;
+        return 0;
+    }
+
+    auto flush() -> int override {
+        return track(control::stats.flushes, [&] { return flush_all(); });
+    }
+
+    auto flush_all() -> int {
+        if(!flush_trim()) {
+            return EIO;
+        }
+        if(cache != nullptr && !cache->sync()) {
+            return EIO;
+        }
+        if(overlay != nullptr && !overlay->sync()) {
+            return EIO;
+        }
+        return 0;
+    }
+
+    auto disconnect() -> void override {
+        exclusive([this] { return flush_all(); });
+    }
 };
 
-auto run_edl_abuse(Device& dev, const size_t disk, const size_t total_blocks) -> int {
+// serves the nbd protocol itself on listen_address if given, otherwise attaches to the kernel nbd driver
+auto run_edl_abuse(Device& dev, const size_t disk, const size_t total_blocks, BlockCache* const cache, Overlay* const overlay, lazy::Copier* const copier, const char* const listen_address) -> int {
     auto op        = EDLOperator{};
     op.dev         = &dev;
     op.disk        = disk;
+    op.cache       = cache;
+    op.overlay     = overlay;
+    op.copier      = copier;
     op.block_size  = fh::bytes_per_sector;
     op.block_count = total_blocks;
-    return buse::run("/dev/nbd0", op);
+    if(listen_address != nullptr) {
+        return nbd::serve(op, listen_address) ? 0 : 1;
+    }
+    // buse::run does not announce trim, the flags are preset on the device,
+    // the kernel keeps them as long as the device stays open
+    const auto nbd_path = "/dev/nbd0";
+    const auto nbd      = FileDescriptor(open(nbd_path, O_RDWR | O_CLOEXEC));
+    ensure(nbd.as_handle() >= 0, "failed to open {}: {}", nbd_path, strerror(errno));
+    ensure(ioctl(nbd.as_handle(), NBD_SET_FLAGS, NBD_FLAG_HAS_FLAGS | NBD_FLAG_SEND_FLUSH | NBD_FLAG_SEND_TRIM) == 0, "failed to set nbd flags: {}", strerror(errno));
+    return buse::run(nbd_path, op);
 }
 
-auto assume_total_blocks(Device& dev, const size_t disk) -> size_t {
-    auto current  = 1024uz * 1024 * 4 / fh::bytes_per_sector; // 4MiB
-    auto null_buf = std::array<std::byte, fh::bytes_per_sector>();
-    while(true) {
-        if(fh::read_disk(dev, disk, current, 1, null_buf.data())) {
-            current *= 2;
-        } else {
-            break;
-        }
-    }
-    current /= 2;
-    auto step = current / 2;
-    while(true) {
-        if(fh::read_disk(dev, disk, current, 1, null_buf.data())) {
-            if(step == 0) {
-                return current + 1;
-            }
-            current += step;
-        } else {
-            if(step == 0) {
-                return current;
-            }
-            current -= step;
-        }
-        step /= 2;
+auto commit_overlay(Device& dev, const size_t disk, BlockCache* const cache, Overlay& overlay) -> bool {
+    auto op  = EDLOperator{};
+    op.dev   = &dev;
+    op.disk  = disk;
+    op.cache = cache;
+    ensure(overlay.commit([&op](const size_t block, const size_t blocks, std::byte* const buf) {
+        return op.write_base(block, blocks, buf);
+    }));
+    if(cache != nullptr) {
+        ensure(cache->sync());
     }
+    return true;
+}
+
+// the cached size is trusted if the last block is readable and the next one is not
+auto verify_total_blocks(Device& dev, const size_t disk, const size_t total_blocks) -> bool {
+    auto null_buf = std::vector<std::byte>(fh::bytes_per_sector);
+    return total_blocks != 0 &&
+           fh::read_disk(dev, disk, total_blocks - 1, 1, null_buf.data()) &&
+           !fh::read_disk(dev, disk, total_blocks, 1, null_buf.data());
 }
 } // namespace
 
 auto main(const int argc, const char* const argv[]) -> int {
-    ensure(argc == 3, "argc != 3");
+    constexpr auto usage = "usage: buse DEVICE DISK [CACHE_DIR] [--overlay DIR [--commit]] [--listen unix:PATH|[HOST]:PORT] [--bad-map PATH] [--control PATH] [--clone]";
+
+    ensure(argc >= 3, "{}", usage);
+    auto cache_dir      = (const char*)(nullptr);
+    auto overlay_dir    = (const char*)(nullptr);
+    auto listen_address = (const char*)(nullptr);
+    auto bad_map_path   = (const char*)(nullptr);
+    auto control_path   = (const char*)(nullptr);
+    auto commit         = false;
+    auto clone          = false;
+    for(auto i = 3; i < argc; i += 1) {
+        const auto arg = std::string_view(argv[i]);
+        if(arg == "--overlay" && i + 1 < argc) {
+            overlay_dir = argv[i += 1];
+        } else if(arg == "--listen" && i + 1 < argc) {
+            listen_address = argv[i += 1];
+        } else if(arg == "--bad-map" && i + 1 < argc) {
+            bad_map_path = argv[i += 1];
+        } else if(arg == "--control" && i + 1 < argc) {
+            control_path = argv[i += 1];
+        } else if(arg == "--commit") {
+            commit = true;
+        } else if(arg == "--clone") {
+            clone = true;
+        } else if(!arg.starts_with("--") && cache_dir == nullptr) {
+            cache_dir = argv[i];
+        } else {
+            bail("{}", usage);
+        }
+    }
+    ensure(!commit || overlay_dir != nullptr, "{}", usage);
+    // the clone is kept in the cache directory
+    ensure(!clone || (cache_dir != nullptr && !commit), "{}", usage);
+
     unwrap_mut(dev, setup_serial_device(argv[1]));
 
     unwrap(disk, from_chars<size_t>(argv[2]), "invalid disk number");
-    const auto last_lba = assume_total_blocks(dev, disk);
-    std::println("total size = {} blocks {} KiB {} MiB", last_lba, last_lba * 4, last_lba * 4 / 1024);
 
-    return run_edl_abuse(dev, disk, last_lba);
+    // uploads and configures the programmer unless an earlier session did
+    // the exported block size follows the storage, so that the kernel sends sector aligned requests
+    ensure(attach::run(dev), "failed to attach to the device");
+
+    // reads of known bad sectors fail at once instead of stalling the programmer
+    auto bad_map = std::optional<scan::BadMap>();
+    if(bad_map_path != nullptr) {
+        ensure(bad_map.emplace().load(bad_map_path));
+        ensure(bad_map->disk == disk, "bad range map is for disk {}", bad_map->disk);
+        ensure(fh::set_bad_map(*bad_map));
+    }
+
+    auto serial = std::string();
+    if(cache_dir != nullptr || overlay_dir != nullptr) {
+        unwrap_mut(chip_serial, fh::get_chip_serial(dev));
+        serial = std::move(chip_serial);
+    }
+    if(config::autotune && !fh::load_tuning(dev)) {
+        std::println("continuing without a tuning profile");
+    }
+
+    auto cache = std::optional<BlockCache>();
+    if(cache_dir != nullptr) {
+        ensure(cache.emplace().open(cache_dir, serial, disk, fh::bytes_per_sector));
+    }
+    auto overlay = std::optional<Overlay>();
+    if(overlay_dir != nullptr) {
+        ensure(overlay.emplace().open(overlay_dir, serial, disk, fh::bytes_per_sector));
+    }
+
+    auto last_lba = size_t(0);
+    if(cache && verify_total_blocks(dev, disk, cache->block_count)) {
+        last_lba = cache->block_count;
+        // a clone may hold writes that the device does not, it would never validate
+        if(clone) {
+            std::println("resuming the clone");
+        } else if(!cache->validate(dev, disk)) {
+            std::println("cache is stale, discarding");
+            ensure(cache->reset(last_lba));
+        }
+    } else {
+        last_lba = fh::assume_total_sectors(dev, disk);
+        if(cache) {
+            ensure(cache->reset(last_lba));
+        }
+    }
+    std::println("total size = {} blocks {} KiB {} MiB", last_lba, last_lba * fh::bytes_per_sector / 1024, last_lba * fh::bytes_per_sector / 1024 / 1024);
+
+    if(commit) {
+        ensure(commit_overlay(dev, disk, cache ? &*cache : nullptr, *overlay));
+        return 0;
+    }
+    // serving is one long bulk transfer, lowered only now as sizing and validation expect failed reads and need digest logs
+    // programs raise verbosity for their duration, failed commands until the end of serving, when it is restored
+    const auto quiet = fh::VerbosityScope(dev, false);
+    if(control_path != nullptr) {
+        ensure(control::start(control_path));
+    }
+    // sectors found bad while cloning are added to the --bad-map file
+    auto copier = std::optional<lazy::Copier>();
+    if(clone) {
+        auto map = bad_map ? std::move(*bad_map) : scan::BadMap{disk, fh::bytes_per_sector, 0, last_lba, {}};
+        copier.emplace(dev, disk, *cache, std::move(map), bad_map_path != nullptr ? bad_map_path : "");
+        copier->start();
+    }
+    return run_edl_abuse(dev, disk, last_lba, cache ? &*cache : nullptr, overlay ? &*overlay : nullptr, copier ? &*copier : nullptr, listen_address);
 }
@@ -2,10 +2,16 @@
 #include <optional>
 #include <string>
 
+#include "attach.hpp"
+#include "config.hpp"
 #include "firehose-actions.hpp"
+#include "firehose-log.hpp"
+#include "gpt-backup.hpp"
 #include "macros/assert.hpp"
+#include "media-scan.hpp"
 #include "sahara-actions.hpp"
 #include "serial-device.hpp"
+#include "sparse-dump.hpp"
 
 namespace {
 auto read_stdin(const std::optional<std::string_view> prompt = std::nullopt) -> std::string {
@@ -47,21 +53,60 @@ loop:
         ensure(do_get_pkhash(*dev));
     } else if(input == "upload") {
         ensure(do_upload_hello(*dev, "loader.bin"));
+    } else if(input == "autoupload") {
+        ensure(do_upload_from_library(*dev, config::loader_dir));
+    } else if(input.starts_with("autoupload ")) {
+        ensure(do_upload_from_library(*dev, input.substr(11)));
+    } else if(input == "attach") {
+        // the rx buffer may hold a pending sahara hello, it must not be cleared
+        ensure(attach::run(*dev));
+        if(config::autotune && !fh::load_tuning(*dev)) {
+            std::println("continuing without a tuning profile");
+        }
     } else if(input == "fhnop") {
         dev->clear_rx_buffer();
         ensure(fh::send_nop(*dev));
     } else if(input == "fhconf") {
         dev->clear_rx_buffer();
         ensure(fh::send_configure(*dev));
+        if(config::autotune && !fh::load_tuning(*dev)) {
+            std::println("continuing without a tuning profile");
+        }
+    } else if(input == "fhstorage") {
+        // for programmers configured by an earlier session
+        dev->clear_rx_buffer();
+        ensure(fh::load_storage_info(*dev));
+    } else if(input == "fhlog") {
+        for(const auto& log : fh::log::drain()) {
+            std::println("{}", log);
+        }
+        const auto m = fh::log::get_metrics();
+        std::println("{} documents, {} logs ({} bytes), {} errors, {} dropped", m.documents, m.logs, m.log_bytes, m.errors, m.dropped);
     } else if(input == "fhreset") {
         dev->clear_rx_buffer();
         ensure(fh::send_reset(*dev));
     } else if(input.starts_with("fhread ")) {
         dev->clear_rx_buffer();
         ensure(fh::read_to_file(*dev, input.substr(7)));
+    } else if(input.starts_with("fhsparse ")) {
+        dev->clear_rx_buffer();
+        ensure(sparse_read_to_file(*dev, input.substr(9)));
     } else if(input.starts_with("fhwrite ")) {
         dev->clear_rx_buffer();
         ensure(fh::write_from_file(*dev, input.substr(8)));
+    } else if(input.starts_with("fhverify ")) {
+        dev->clear_rx_buffer();
+        ensure(fh::verify_file(*dev, input.substr(9)));
+    } else if(input.starts_with("fhscan ")) {
+        dev->clear_rx_buffer();
+        ensure(scan::scan_to_file(*dev, input.substr(7)));
+    } else if(input.starts_with("fhbadmap ")) {
+        auto map = scan::BadMap();
+        ensure(map.load(input.substr(9)));
+        ensure(fh::set_bad_map(std::move(map)));
+    } else if(input.starts_with("fhbackup ")) {
+        dev->clear_rx_buffer();
+        ensure(backup::backup_luns(*dev, input.substr(9)));
     } else if(input.starts_with("raw ") && input.size() > 4) {
         dev->clear_rx_buffer();
         ensure(dev->write(input.data() + 4, input.size() - 4));
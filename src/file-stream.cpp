@@ -0,0 +1,254 @@
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "buffer-pool.hpp"
+#include "config.hpp"
+#include "file-stream.hpp"
+#include "macros/assert.hpp"
+
+namespace {
+auto open_file(const std::string_view path, const int flags, bool& seekable) -> int {
+    const auto  path_str = std::string(path);
+    struct stat st;
+    const auto  exists = stat(path_str.data(), &st) == 0;
+    seekable           = !exists || S_ISREG(st.st_mode);
+    return ::open(path_str.data(), flags | (seekable && config::direct_file_io ? O_DIRECT : 0), 0644);
+}
+} // namespace
+
+auto FileWriter::write_buffer(const Buffer& buffer) -> bool {
+    auto done = 0uz;
+    while(done < buffer.size) {
+        const auto ret = seekable ? pwrite(fd, buffer.data + done, buffer.size - done, offset + done)
+                                  : ::write(fd, buffer.data + done, buffer.size - done);
+        if(ret < 0 && errno == EINTR) {
+            continue;
+        }
+        ensure(ret > 0, "failed to write output errno={}({})", errno, strerror(errno));
+        done += ret;
+    }
+    offset += done;
+    return true;
+}
+
+auto FileWriter::writer_main() -> void {
+    while(true) {
+        auto l = std::unique_lock(lock);
+        cond.wait(l, [this] { return buffers[tail].size != 0 || finished; });
+        if(buffers[tail].size == 0) {
+            return;
+        }
+        const auto buffer = buffers[tail];
+        const auto start  = offset;
+        l.unlock();
+
+        const auto ok = write_buffer(buffer) && (!on_written || on_written(start, buffer.size));
+
+        l.lock();
+        failed |= !ok;
+        buffers[tail].size = 0;
+        tail               = (tail + 1) % buffers.size();
+        cond.notify_all();
+        if(failed) {
+            return;
+        }
+    }
+}
+
+auto FileWriter::stop() -> void {
+    {
+        auto l   = std::unique_lock(lock);
+        finished = true;
+        cond.notify_all();
+    }
+    if(thread.joinable()) {
+        thread.join();
+    }
+}
+
+auto FileWriter::open(const std::string_view path, const size_t total_bytes) -> bool {
+    if(path.starts_with("|")) {
+        pipe = popen(std::string(path.substr(1)).data(), "w");
+        ensure(pipe != nullptr, "failed to run {} errno={}({})", path.substr(1), errno, strerror(errno));
+        fd = fileno(pipe);
+    } else {
+        fd = open_file(path, O_WRONLY | O_CREAT, seekable);
+        ensure(fd >= 0, "failed to open {} errno={}({})", path, errno, strerror(errno));
+        if(seekable) {
+            ensure(ftruncate(fd, total_bytes) == 0);
+        }
+    }
+
+    // pooled buffers are page aligned as O_DIRECT requires
+    for(auto i = 0uz; i < config::file_buffers; i += 1) {
+        auto& buffer = memory.emplace_back(pool::acquire(config::file_buffer_bytes));
+        ensure(!buffer.empty(), "failed to allocate buffer");
+        buffers.push_back(Buffer{buffer.data(), 0});
+    }
+    thread = std::thread(&FileWriter::writer_main, this);
+    return true;
+}
+
+auto FileWriter::acquire() -> std::span<std::byte> {
+    auto l = std::unique_lock(lock);
+    cond.wait(l, [this] { return buffers[head].size == 0 || failed; });
+    if(failed) {
+        return {};
+    }
+    return {buffers[head].data, config::file_buffer_bytes};
+}
+
+auto FileWriter::commit(const size_t size) -> void {
+    if(size == 0) {
+        return;
+    }
+    auto l             = std::unique_lock(lock);
+    buffers[head].size = size;
+    head               = (head + 1) % buffers.size();
+    cond.notify_all();
+}
+
+auto FileWriter::finish() -> bool {
+    stop();
+    ensure(!failed);
+    if(pipe != nullptr) {
+        const auto status = pclose(pipe);
+        pipe              = nullptr;
+        fd                = -1;
+        ensure(status == 0, "pipe command exited with status {}", status);
+    } else if(fd >= 0) {
+        ensure(close(fd) == 0);
+        fd = -1;
+    }
+    return true;
+}
+
+FileWriter::~FileWriter() {
+    stop();
+    if(pipe != nullptr) {
+        pclose(pipe);
+    } else if(fd >= 0) {
+        close(fd);
+    }
+}
+
+auto FileReader::read_buffer(Buffer& buffer) -> bool {
+    const auto len  = std::min(config::file_buffer_bytes, total - offset);
+    auto       done = 0uz;
+    while(done < len) {
+        const auto ret = ::read(fd, buffer.data + done, len - done);
+        if(ret < 0 && errno == EINTR) {
+            continue;
+        }
+        ensure(ret >= 0, "failed to read input errno={}({})", errno, strerror(errno));
+        ensure(ret > 0, "input ended at byte {}, expected {}", offset + done, total);
+        done += ret;
+    }
+    offset += done;
+    buffer.size = done;
+    return true;
+}
+
+auto FileReader::reader_main() -> void {
+    while(offset < total) {
+        auto l = std::unique_lock(lock);
+        cond.wait(l, [this] { return buffers[tail].size == 0 || finished; });
+        if(finished) {
+            return;
+        }
+        auto buffer = buffers[tail];
+        l.unlock();
+
+        const auto ok = read_buffer(buffer);
+
+        l.lock();
+        failed |= !ok;
+        buffers[tail].size = buffer.size;
+        tail               = (tail + 1) % buffers.size();
+        cond.notify_all();
+        if(failed) {
+            return;
+        }
+    }
+}
+
+auto FileReader::stop() -> void {
+    {
+        auto l   = std::unique_lock(lock);
+        finished = true;
+        cond.notify_all();
+    }
+    if(thread.joinable()) {
+        thread.join();
+    }
+}
+
+auto FileReader::open(const std::string_view path, const size_t total_bytes) -> bool {
+    if(path.starts_with("|")) {
+        pipe = popen(std::string(path.substr(1)).data(), "r");
+        ensure(pipe != nullptr, "failed to run {} errno={}({})", path.substr(1), errno, strerror(errno));
+        fd = fileno(pipe);
+    } else {
+        auto seekable = false;
+        fd            = open_file(path, O_RDONLY, seekable);
+        ensure(fd >= 0, "failed to open {} errno={}({})", path, errno, strerror(errno));
+        if(seekable) {
+            posix_fadvise(fd, 0, total_bytes, POSIX_FADV_SEQUENTIAL);
+        }
+    }
+
+    total = total_bytes;
+    // pooled buffers are page aligned as O_DIRECT requires
+    for(auto i = 0uz; i < config::prefetch_buffers; i += 1) {
+        auto& buffer = memory.emplace_back(pool::acquire(config::file_buffer_bytes));
+        ensure(!buffer.empty(), "failed to allocate buffer");
+        buffers.push_back(Buffer{buffer.data(), 0});
+    }
+    thread = std::thread(&FileReader::reader_main, this);
+    return true;
+}
+
+auto FileReader::acquire() -> std::span<const std::byte> {
+    auto l = std::unique_lock(lock);
+    cond.wait(l, [this] { return buffers[head].size != 0 || failed; });
+    if(failed) {
+        return {};
+    }
+    return {buffers[head].data, buffers[head].size};
+}
+
+auto FileReader::release() -> void {
+    auto l             = std::unique_lock(lock);
+    buffers[head].size = 0;
+    head               = (head + 1) % buffers.size();
+    cond.notify_all();
+}
+
+auto FileReader::finish() -> bool {
+    stop();
+    ensure(!failed);
+    if(pipe != nullptr) {
+        // all requested bytes were received, so the exit status does not matter
+        // (the command fails with EPIPE if it produced more than requested)
+        pclose(pipe);
+        pipe = nullptr;
+        fd   = -1;
+    } else if(fd >= 0) {
+        ensure(close(fd) == 0);
+        fd = -1;
+    }
+    return true;
+}
+
+FileReader::~FileReader() {
+    stop();
+    if(pipe != nullptr) {
+        pclose(pipe);
+    } else if(fd >= 0) {
+        close(fd);
+    }
+}
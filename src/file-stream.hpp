@@ -0,0 +1,88 @@
+#pragma once
+#include <condition_variable>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "buffer-pool.hpp"
+
+// sequential file output that writes the previous buffer on a worker thread while the caller fills the next one
+// path may be a regular file, a pipe or character device, or "|command" to feed a shell command
+class FileWriter {
+  private:
+    struct Buffer {
+        std::byte* data;
+        size_t     size; // filled bytes, 0 if free
+    };
+
+    int                       fd       = -1;
+    FILE*                     pipe     = nullptr;
+    bool                      seekable = false;
+    size_t                    offset   = 0;
+    std::vector<pool::Buffer> memory;
+    std::vector<Buffer>       buffers;
+    size_t                    head     = 0; // next buffer to fill
+    size_t                    tail     = 0; // next buffer to write
+    bool                      finished = false;
+    bool                      failed   = false;
+    std::mutex                lock;
+    std::condition_variable   cond;
+    std::thread               thread;
+
+    auto write_buffer(const Buffer& buffer) -> bool;
+    auto writer_main() -> void;
+    auto stop() -> void;
+
+  public:
+    // called on the writer thread after a buffer was written
+    std::function<bool(size_t offset, size_t size)> on_written;
+
+    auto open(std::string_view path, size_t total_bytes) -> bool;
+    // returns an empty span if the writer failed
+    auto acquire() -> std::span<std::byte>;
+    auto commit(size_t size) -> void;
+    auto finish() -> bool;
+
+    ~FileWriter();
+};
+
+// sequential file input that reads ahead into a ring of buffers on a worker thread
+// path may be a regular file, a pipe or character device, or "|command" to read a shell command's output
+class FileReader {
+  private:
+    struct Buffer {
+        std::byte* data;
+        size_t     size; // filled bytes, 0 if empty
+    };
+
+    int                       fd     = -1;
+    FILE*                     pipe   = nullptr;
+    size_t                    offset = 0;
+    size_t                    total  = 0;
+    std::vector<pool::Buffer> memory;
+    std::vector<Buffer>       buffers;
+    size_t                    head     = 0; // next buffer to consume
+    size_t                    tail     = 0; // next buffer to fill
+    bool                      finished = false;
+    bool                      failed   = false;
+    std::mutex                lock;
+    std::condition_variable   cond;
+    std::thread               thread;
+
+    auto read_buffer(Buffer& buffer) -> bool;
+    auto reader_main() -> void;
+    auto stop() -> void;
+
+  public:
+    auto open(std::string_view path, size_t total_bytes) -> bool;
+    // returns an empty span if the reader failed
+    auto acquire() -> std::span<const std::byte>;
+    auto release() -> void;
+    auto finish() -> bool;
+
+    ~FileReader();
+};
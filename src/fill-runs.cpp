@@ -0,0 +1,72 @@
+#include <bit>
+
+#include <immintrin.h>
+
+#include "fill-runs.hpp"
+
+namespace fill {
+namespace {
+// bails out at the first 128 bytes that differ, so that data is rejected after a few loads
+[[gnu::target("avx2")]] auto is_filled_avx2(const std::byte* data, size_t size, const std::byte value) -> bool {
+    const auto pattern = _mm256_set1_epi8(char(value));
+    for(; size >= 128; size -= 128, data += 128) {
+        const auto p    = std::bit_cast<const __m256i*>(data);
+        const auto diff = _mm256_or_si256(_mm256_or_si256(_mm256_xor_si256(_mm256_loadu_si256(p + 0), pattern), _mm256_xor_si256(_mm256_loadu_si256(p + 1), pattern)),
+                                          _mm256_or_si256(_mm256_xor_si256(_mm256_loadu_si256(p + 2), pattern), _mm256_xor_si256(_mm256_loadu_si256(p + 3), pattern)));
+        if(!_mm256_testz_si256(diff, diff)) {
+            return false;
+        }
+    }
+    for(; size > 0; size -= 1, data += 1) {
+        if(*data != value) {
+            return false;
+        }
+    }
+    return true;
+}
+
+auto is_filled_sse2(const std::byte* data, size_t size, const std::byte value) -> bool {
+    const auto pattern = _mm_set1_epi8(char(value));
+    for(; size >= 64; size -= 64, data += 64) {
+        const auto p  = std::bit_cast<const __m128i*>(data);
+        const auto eq = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128(p + 0), pattern), _mm_cmpeq_epi8(_mm_loadu_si128(p + 1), pattern)),
+                                      _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128(p + 2), pattern), _mm_cmpeq_epi8(_mm_loadu_si128(p + 3), pattern)));
+        if(_mm_movemask_epi8(eq) != 0xffff) {
+            return false;
+        }
+    }
+    for(; size > 0; size -= 1, data += 1) {
+        if(*data != value) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const auto is_filled_impl = __builtin_cpu_supports("avx2") ? is_filled_avx2 : is_filled_sse2;
+} // namespace
+
+auto is_filled(const std::byte* const data, const size_t size, const std::byte value) -> bool {
+    return is_filled_impl(data, size, value);
+}
+
+auto find_runs(const std::byte* const data, const size_t sector_bytes, const size_t num_sectors, const size_t min_sectors) -> std::vector<Run> {
+    auto r   = std::vector<Run>();
+    auto run = Run{0, 0, std::byte(0)};
+    for(auto i = 0uz; i <= num_sectors; i += 1) {
+        const auto sector = data + i * sector_bytes;
+        const auto value  = i < num_sectors ? sector[0] : std::byte(0x5a);
+        if(run.count != 0 && value == run.value && is_filled(sector, sector_bytes, value)) {
+            run.count += 1;
+            continue;
+        }
+        // the run ended at this sector
+        if(run.count >= min_sectors) {
+            r.push_back(run);
+        }
+        const auto uniform = i < num_sectors && (value == std::byte(0x00) || value == std::byte(0xff)) && is_filled(sector, sector_bytes, value);
+        run                = Run{i, uniform ? 1uz : 0uz, value};
+    }
+    return r;
+}
+} // namespace fill
@@ -0,0 +1,17 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+// runs of sectors whose bytes all hold one value, 0x00 or 0xff like erased flash
+namespace fill {
+struct Run {
+    size_t    begin; // in sectors
+    size_t    count;
+    std::byte value;
+};
+
+// whether every byte of data equals value, vectorized
+auto is_filled(const std::byte* data, size_t size, std::byte value) -> bool;
+// runs of at least min_sectors sectors of 0x00 or 0xff, in order
+auto find_runs(const std::byte* data, size_t sector_bytes, size_t num_sectors, size_t min_sectors) -> std::vector<Run>;
+} // namespace fill
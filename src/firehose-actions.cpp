@@ -1,148 +1,180 @@
 #include <array>
+#include <chrono>
+#include <cstdlib>
 #include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
 
 #include <fcntl.h>
-#include <sys/mman.h>
+#include <strings.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include "buffer-pool.hpp"
+#include "chunk-store.hpp"
+#include "compressed-image.hpp"
 #include "config.hpp"
+#include "file-stream.hpp"
+#include "fill-runs.hpp"
 #include "firehose-actions.hpp"
+#include "firehose-xml.hpp"
 #include "macros/unwrap.hpp"
+#include "sha256.hpp"
+#include "transfer-journal.hpp"
+#include "transfer-tuner.hpp"
 #include "util/charconv.hpp"
-#include "util/split.hpp"
 #include "xml/xml.hpp"
 
 namespace fh {
 namespace {
-const auto xml_header = std::string(R"(<?xml version="1.0"?>)");
+auto send_rw_command(Device& dev, const size_t disk, const size_t sector_begin, const size_t num_sectors, const char* const command) -> bool {
+    const auto payload = build_rw_command(disk, sector_begin, num_sectors, command);
+    ensure(dev.write(payload.data(), payload.size()), "failed to send command: {}", command);
+    ensure(wait_for_ack(dev), "cannot read ready ack");
+    return true;
+}
 
-struct ParsedXML {
-    std::string key;
-    std::string value;
-};
+auto make_manifest(const RWArgs& args, checksum::Stream& sums) -> checksum::Manifest {
+    return checksum::Manifest{args.disk, args.sector_begin, args.num_sectors, config::checksum_chunk_bytes / bytes_per_sector, sums.finish()};
+}
 
-auto parse_xml(std::string_view str) -> std::optional<std::vector<ParsedXML>> {
-    auto r = std::vector<ParsedXML>();
-    while(!str.empty()) {
-        // remove xml header
-        const auto header_begin = str.find("<?xml");
-        ensure(header_begin != str.npos, "failed to find xml header");
-        const auto header_end = str.find("?>", header_begin);
-        ensure(header_end != str.npos, "failed to find xml header");
-        str.remove_prefix(header_end + 2);
-
-        // find data body
-        const auto body_begin = str.find("<");
-        ensure(body_begin != str.npos, "failed to find xml body");
-        const auto next_header_begin = str.find("<?xml");
-        const auto body_end          = next_header_begin != str.npos ? next_header_begin : str.size();
-        const auto body              = str.substr(body_begin, body_end - body_begin);
-        str.remove_prefix(body_end);
-
-        // parse xml
-        unwrap(node, xml::parse(body));
-        ensure(node.name == "data", "got unknown xml element");
-        for(const auto& c : node.children) {
-            if(const auto value = c.find_attr("value"); !value) {
-                continue;
-            } else {
-                r.push_back(ParsedXML{std::string(c.name), std::string(*value)});
-            }
+// journal of an interrupted transfer, chunks are the transfer buffers
+struct Resume {
+    TransferJournal   journal;
+    FileDescriptor    existing; // output of an interrupted dump
+    std::vector<bool> done;     // taken before the transfer starts, the journal itself is updated on the writer thread
+    size_t            chunk_sectors;
+
+    auto open(const RWArgs& args, const TransferJournal::Kind kind, const size_t buffer_bytes) -> bool {
+        const auto read = kind == TransferJournal::Kind::Read;
+        chunk_sectors   = buffer_bytes / bytes_per_sector;
+        ensure(journal.open(args.file, kind, args.disk, args.sector_begin, args.num_sectors, chunk_sectors, read));
+        done.resize(journal.chunk_count);
+        for(auto i = 0uz; i < done.size(); i += 1) {
+            done[i] = journal.is_done(i);
         }
+        if(read) {
+            existing = FileDescriptor(::open(std::string(args.file).data(), O_RDONLY));
+            ensure(existing.as_handle() >= 0);
+        }
+        return true;
     }
-    return r;
-}
-
-auto receive_xml(Device& dev) -> std::optional<std::vector<ParsedXML>> {
-    auto       buf       = std::string();
-    const auto read_char = [&dev, &buf]() -> bool {
-        constexpr auto error_value = false;
 
-        auto c = char();
-        ensure_v(dev.read(&c, 1) > 0);
-        buf.push_back(c);
-        return true;
-    };
+    auto is_done(const size_t sector) const -> bool {
+        return done[sector / chunk_sectors];
+    }
+};
 
-    static const auto minimal = std::string_view(R"(<?xml version="1.0" encoding="UTF-8"?><data></data>)");
-    buf.resize(minimal.size());
-    ensure(dev.read(buf.data(), minimal.size()));
-    ensure(buf.starts_with("<?xml"), "not a xml");
+// regular files only, pipes cannot be rewound
+auto is_resumable_path(const std::string_view path) -> bool {
+    if(path.starts_with("|")) {
+        return false;
+    }
+    struct stat st;
+    return stat(std::string(path).data(), &st) != 0 || S_ISREG(st.st_mode);
+}
 
-    static const auto marker = std::string_view("</data>");
-    while(true) {
-        const auto tail = std::string_view(buf.data() + buf.size() - marker.size());
-        if(tail == marker) {
-            break;
+// Writer is FileWriter, edlz::Writer or cas::Writer
+template <class Writer>
+auto read_to_writer(Device& dev, const RWArgs& args, Writer& writer, const Resume* const resume = nullptr) -> bool {
+    const auto quiet = VerbosityScope(dev, false);
+    auto       sums  = std::optional<checksum::Stream>();
+    if(config::checksum_dumps && checksum::can_have_sidecar(args.file)) {
+        sums.emplace().start(config::checksum_chunk_bytes);
+    }
+    for(auto sector = 0uz; sector < args.num_sectors;) {
+        const auto buf = writer.acquire();
+        ensure(!buf.empty(), "failed to write output");
+        const auto sectors = std::min(buf.size() / bytes_per_sector, args.num_sectors - sector);
+        if(resume != nullptr && resume->is_done(sector)) {
+            // dumped by the interrupted run, reloaded so that the writer and checksum stay sequential
+            const auto bytes = sectors * bytes_per_sector;
+            ensure(pread(resume->existing.as_handle(), buf.data(), bytes, sector * bytes_per_sector) == ssize_t(bytes), "failed to reload dumped data");
+        } else {
+            ensure(read_disk_around_bad(dev, args.disk, args.sector_begin + sector, sectors, buf.data()));
         }
-        ensure(read_char());
+        if(sums) {
+            sums->update(buf.first(sectors * bytes_per_sector));
+        }
+        writer.commit(sectors * bytes_per_sector);
+        sector += sectors;
+    }
+    ensure(writer.finish());
+    if(sums) {
+        ensure(checksum::write_manifest(args.file, make_manifest(args, *sums)));
     }
-    unwrap(xml, parse_xml(buf));
-    return xml;
+    return true;
 }
 
-auto find_response(const std::vector<ParsedXML>& nodes) -> std::string_view {
-    for(const auto& r : nodes) {
-        if(r.key == "response") {
-            return r.value;
+auto digests_supported = std::optional<bool>(); // getsha256digest works with this programmer, probed once per configure
+
+// a programmer without the command answers NAK, any sector of the target tells
+auto probe_digests(Device& dev, const RWArgs& args) -> bool {
+    if(!digests_supported) {
+        const auto loud   = VerbosityScope(dev, true);
+        digests_supported = get_sha256_digest(dev, args.disk, args.sector_begin, 1).has_value();
+        if(!*digests_supported) {
+            std::println("programmer does not answer getsha256digest, flashed data is not verified in this session");
         }
     }
-    return {};
+    return *digests_supported;
 }
 
-auto wait_for_ack(Device& dev) -> bool {
-loop:
-    unwrap(xml, receive_xml(dev));
-    if(const auto r = find_response(xml); !r.empty()) {
-        return r == "ACK";
+// hashes what is flashed, and compares it with the device afterwards
+struct WriteVerifier {
+    std::optional<checksum::Stream> sums;
+
+    // fill runs are only left out when the device digests are compared afterwards
+    auto skip_fill_runs() const -> bool {
+        return config::skip_fill_runs && sums.has_value();
     }
-    goto loop;
-}
 
-auto send_rw_command(Device& dev, const size_t disk, const size_t sector_begin, const size_t num_sectors, const char* const command) -> bool {
-    const auto node =
-        xml::Node{
-            .name = "data",
+    auto update(const std::byte* const data, const size_t sectors) -> void {
+        if(sums) {
+            sums->update({data, sectors * bytes_per_sector});
         }
-            .append_children({
-                xml::Node{.name = command}
-                    .append_attrs({
-                        {"SECTOR_SIZE_IN_BYTES", std::to_string(fh::bytes_per_sector)},
-                        {"num_partition_sectors", std::to_string(num_sectors)},
-                        {"physical_partition_number", std::to_string(disk)},
-                        {"start_sector", std::to_string(sector_begin)},
-                    }),
-            });
-    const auto payload = xml_header + xml::deparse(node);
-    ensure(dev.write(payload.data(), payload.size()), "failed to send command: {}", command);
-    ensure(wait_for_ack(dev), "cannot read ready ack");
-    return true;
-}
+    }
 
-struct RWArgs {
-    size_t           disk;
-    size_t           sector_begin;
-    size_t           num_sectors;
-    std::string_view file;
-};
+    auto finish(Device& dev, const RWArgs& args) -> bool {
+        if(sums) {
+            ensure(verify_digests(dev, make_manifest(args, *sums)));
+        }
+        return true;
+    }
 
-auto parse_rw_args(const std::string_view str, RWArgs& args) -> bool {
-    const auto elms = split(str, " ");
-    ensure(elms.size() == 4, "invalid number of arguments");
-    const auto disk = from_chars<size_t>(elms[0]);
-    ensure(disk, "invalid disk");
-    const auto sector_begin = from_chars<size_t>(elms[1]);
-    ensure(sector_begin, "invalid sector begin");
-    const auto num_sectors = from_chars<size_t>(elms[2]);
-    ensure(num_sectors, "invalid num sectors");
-    const auto output_name = elms[3];
+    WriteVerifier(Device& dev, const RWArgs& args) {
+        if(config::verify_writes && probe_digests(dev, args)) {
+            sums.emplace().start(config::checksum_chunk_bytes);
+        }
+    }
+};
 
-    args = RWArgs{*disk, *sector_begin, *num_sectors, output_name};
+// Reader has random access read() like edlz::Reader
+template <class Reader>
+auto write_from_image(Device& dev, const RWArgs& args, Reader& reader, const size_t buffer_bytes) -> bool {
+    ensure(reader.get_total_bytes() >= args.num_sectors * bytes_per_sector, "image is too small");
+    const auto buf      = pool::acquire(buffer_bytes);
+    auto       verifier = WriteVerifier(dev, args);
+    auto       resume   = Resume();
+    ensure(!buf.empty(), "failed to allocate buffer");
+    ensure(resume.open(args, TransferJournal::Kind::Write, buffer_bytes));
+    for(auto sector = 0uz; sector < args.num_sectors;) {
+        const auto sectors = std::min(buf.size() / bytes_per_sector, args.num_sectors - sector);
+        ensure(reader.read(sector * bytes_per_sector, sectors * bytes_per_sector, buf.data()));
+        if(!resume.is_done(sector)) {
+            ensure(write_disk(dev, args.disk, args.sector_begin + sector, sectors, buf.data(), verifier.skip_fill_runs()));
+            ensure(resume.journal.mark_done(sector / resume.chunk_sectors));
+        }
+        verifier.update(buf.data(), sectors);
+        sector += sectors;
+    }
+    ensure(verifier.finish(dev, args));
+    ensure(resume.journal.remove());
     return true;
 }
-} // namespace
 
-auto send_nop(Device& dev) -> bool {
+auto receive_nop_logs(Device& dev) -> std::optional<std::vector<ParsedXML>> {
     const auto node =
         xml::Node{
             .name = "data",
@@ -155,21 +187,46 @@ auto send_nop(Device& dev) -> bool {
 
     auto logs = std::vector<ParsedXML>();
     while(true) {
-        unwrap(nodes, receive_xml(dev));
+        unwrap_mut(nodes, receive_xml(dev));
         for(auto& node : nodes) {
             if(node.key == "response") {
-                goto end;
+                return logs;
             }
             if(node.key == "log") {
                 if(node.value.starts_with("End of supported functions") ||
                    node.value.starts_with("ERROR")) {
-                    goto end;
+                    return logs;
                 }
             }
             logs.emplace_back(std::move(node));
         }
     }
-end:
+}
+} // namespace
+
+auto parse_rw_args(std::string_view str, RWArgs& args) -> bool {
+    auto elms = std::array<std::string_view, 3>();
+    for(auto& elm : elms) {
+        const auto pos = str.find(' ');
+        ensure(pos != str.npos, "invalid number of arguments");
+        elm = str.substr(0, pos);
+        str.remove_prefix(pos + 1);
+    }
+    ensure(!str.empty(), "invalid number of arguments");
+    const auto disk = from_chars<size_t>(elms[0]);
+    ensure(disk, "invalid disk");
+    const auto sector_begin = from_chars<size_t>(elms[1]);
+    ensure(sector_begin, "invalid sector begin");
+    const auto num_sectors = from_chars<size_t>(elms[2]);
+    ensure(num_sectors, "invalid num sectors");
+    const auto output_name = str;
+
+    args = RWArgs{*disk, *sector_begin, *num_sectors, output_name};
+    return true;
+}
+
+auto send_nop(Device& dev) -> bool {
+    unwrap(logs, receive_nop_logs(dev));
     auto supported_features_begin = false;
     auto supported_features       = std::vector<std::string_view>();
     for(const auto& log : logs) {
@@ -191,7 +248,114 @@ end:
     return true;
 }
 
-auto send_configure(Device& dev) -> bool {
+auto get_chip_serial(Device& dev) -> std::optional<std::string> {
+    // "Chip serial num: 1234567890 (0x499602d2)"
+    static const auto prefix = std::string_view("Chip serial num: ");
+
+    unwrap(logs, receive_nop_logs(dev));
+    for(const auto& log : logs) {
+        if(!log.value.starts_with(prefix)) {
+            continue;
+        }
+        const auto value = std::string_view(log.value).substr(prefix.size());
+        return std::string(value.substr(0, value.find(' ')));
+    }
+    bail("programmer did not report chip serial");
+}
+
+namespace {
+auto read_tuner    = TransferTuner();
+auto program_tuner = TransferTuner();
+auto tuning_path   = std::string(); // empty until load_tuning identified the device
+
+auto save_tuning_if_changed() -> void {
+    const auto read_changed    = read_tuner.take_changed();
+    const auto program_changed = program_tuner.take_changed();
+    if(tuning_path.empty() || !(read_changed || program_changed)) {
+        return;
+    }
+    auto file = std::ofstream(tuning_path);
+    file << std::format("{} {}\n", read_tuner.get_current(), program_tuner.get_current());
+    if(!file) {
+        std::println("failed to save tuning profile {}", tuning_path);
+    }
+}
+
+auto get_tuning_dir() -> std::optional<std::string> {
+    if(config::tune_profile_dir[0] != '\0') {
+        return config::tune_profile_dir;
+    }
+    if(const auto cache = getenv("XDG_CACHE_HOME"); cache != nullptr && cache[0] != '\0') {
+        return std::format("{}/edl-tune", cache);
+    }
+    const auto home = getenv("HOME");
+    ensure(home != nullptr, "neither XDG_CACHE_HOME nor HOME is set");
+    return std::format("{}/.cache/edl-tune", home);
+}
+} // namespace
+
+auto load_tuning(Device& dev) -> bool {
+    // hw id is not available in a firehose session, the programmer's banner identifies the model instead
+    unwrap(logs, receive_nop_logs(dev));
+    auto banner = std::string();
+    for(const auto& log : logs) {
+        if(!log.value.starts_with("Chip serial num")) {
+            banner += log.value;
+            banner += '\n';
+        }
+    }
+    const auto model = sha256::to_hex(sha256::digest(std::as_bytes(std::span(banner)))).substr(0, 16);
+
+    unwrap(dir, get_tuning_dir());
+    // $HOME/.cache may not exist yet on a fresh account
+    auto error = std::error_code();
+    std::filesystem::create_directories(dir, error);
+    ensure(!error, "failed to create {}: {}", dir, error.message());
+    tuning_path = std::format("{}/{}", dir, model);
+
+    auto file    = std::ifstream(tuning_path);
+    auto read    = 0uz;
+    auto program = 0uz;
+    if(file >> read >> program) {
+        read_tuner.set_current(read);
+        program_tuner.set_current(program);
+        std::println("tuning profile {}: read {} sectors, program {} sectors", model, read, program);
+    }
+    return true;
+}
+
+namespace {
+auto verbose             = std::optional<bool>(true); // Verbose of the last configure
+auto verbosity_supported = true; // false once the programmer rejected a reconfigure
+auto erased_probed       = false; // erased_value is known
+auto erased_value        = std::optional<std::byte>(); // what an erase leaves behind, nullopt if not uniform
+
+struct StorageType {
+    Storage     storage;
+    const char* memory_name;
+    size_t      bytes_per_sector;
+};
+
+// nand programmers address pages, getstorageinfo tells the real page size
+constexpr auto storage_types = std::array{
+    StorageType{Storage::UFS, "UFS", 4096},
+    StorageType{Storage::eMMC, "eMMC", 512},
+    StorageType{Storage::NAND, "NAND", 4096},
+};
+
+// MaxPayloadSizeToTargetInBytes of configure
+constexpr auto max_payload_bytes = 4096uz;
+
+auto find_storage_type(const std::string_view name) -> const StorageType* {
+    for(const auto& type : storage_types) {
+        if(strcasecmp(std::string(name).data(), type.memory_name) == 0) {
+            return &type;
+        }
+    }
+    return nullptr;
+}
+
+auto try_configure(Device& dev, const StorageType& type, const bool verbose, const bool skip_storage_init) -> bool {
     const auto node =
         xml::Node{
             .name = "data",
@@ -199,19 +363,183 @@ auto send_configure(Device& dev) -> bool {
             .append_children({
                 xml::Node{.name = "configure"}
                     .append_attrs({
-                        {"MemoryName", "UFS"},
-                        {"Verbose", "1"},
+                        {"MemoryName", type.memory_name},
+                        {"Verbose", verbose ? "1" : "0"},
                         {"AlwaysValidate", "0"},
                         {"MaxDigestTableSizeInBytes", "2048"},
-                        {"MaxPayloadSizeToTargetInBytes", "4096"},
+                        {"MaxPayloadSizeToTargetInBytes", std::to_string(max_payload_bytes)},
                         {"ZLPAwareHost", "1"},
-                        {"SkipStorageInit", "0"},
+                        {"SkipStorageInit", skip_storage_init ? "1" : "0"},
                         {"SkipWrite", "0"},
                     }),
             });
     const auto payload = xml_header + xml::deparse(node);
     ensure(dev.write(payload.data(), payload.size()), "failed to send command");
-    ensure(wait_for_ack(dev), "cannot read done ack");
+    return wait_for_ack(dev);
+}
+
+// getstorageinfo reports json on recent programmers:
+//   INFO: {"storage_info": {"total_blocks":31227904, "block_size":4096, "page_size":4096, "num_physical":6, "mem_type":"UFS", ...}}
+// and plain lines on older ones:
+//   Device Total Logical Blocks: 0x1dc8000
+//   Device Block Size in Bytes: 0x1000
+auto find_info_value(const std::string_view log, const std::string_view key) -> std::string_view {
+    auto pos = log.find(key);
+    if(pos == log.npos || (pos = log.find(':', pos + key.size())) == log.npos) {
+        return {};
+    }
+    auto value = log.substr(pos + 1);
+    while(value.starts_with(' ') || value.starts_with('"')) {
+        value.remove_prefix(1);
+    }
+    return value.substr(0, value.find_first_of(",}\" "));
+}
+
+auto parse_info_number(const std::string_view value) -> size_t {
+    const auto hex = value.starts_with("0x");
+    return from_chars<size_t>(hex ? value.substr(2) : value, hex ? 16 : 10).value_or(0);
+}
+
+auto set_storage(const StorageType& type, const size_t sector_bytes) -> void {
+    storage           = type.storage;
+    bytes_per_sector  = sector_bytes != 0 ? sector_bytes : type.bytes_per_sector;
+    erased_probed     = false;
+    digests_supported = std::nullopt;
+    std::println("storage: {}, {} bytes per sector", type.memory_name, bytes_per_sector);
+}
+
+// page size for nand, block size for the others
+auto get_sector_bytes(const StorageType& type, const StorageInfo& info) -> size_t {
+    return type.storage == Storage::NAND && info.page_size != 0 ? info.page_size : info.block_size;
+}
+} // namespace
+
+auto get_verbose() -> std::optional<bool> {
+    return verbose;
+}
+
+auto set_verbose(Device& dev, const bool value) -> bool {
+    if(value == verbose) {
+        return true;
+    }
+    ensure(verbosity_supported);
+    // configure again on the same storage, the programmer keeps its state
+    const auto& type = *std::ranges::find(storage_types, storage, &StorageType::storage);
+    if(!try_configure(dev, type, value, true)) {
+        std::println("programmer does not support changing verbosity");
+        verbosity_supported = false;
+        return false;
+    }
+    verbose = value;
+    return true;
+}
+
+// with config::quiet_transfers the logs would only be parsed to be dropped while looking for acks
+VerbosityScope::VerbosityScope(Device& dev, const bool verbose) {
+    if(!verbose && !config::quiet_transfers) {
+        return;
+    }
+    const auto current = get_verbose();
+    if(current != verbose && set_verbose(dev, verbose)) {
+        this->dev      = &dev;
+        this->previous = current.value_or(true);
+    }
+}
+
+VerbosityScope::~VerbosityScope() {
+    if(dev != nullptr) {
+        set_verbose(*dev, previous);
+    }
+}
+
+auto send_configure(Device& dev) -> bool {
+    auto type = (const StorageType*)(nullptr);
+    if(config::memory_name[0] != '\0') {
+        type = find_storage_type(config::memory_name);
+        ensure(type != nullptr, "unknown memory name {}", config::memory_name);
+        ensure(try_configure(dev, *type, true, false), "programmer rejected {}", type->memory_name);
+    } else {
+        for(const auto& t : storage_types) {
+            if(try_configure(dev, t, true, false)) {
+                type = &t;
+                break;
+            }
+        }
+        ensure(type != nullptr, "programmer rejected every memory type");
+    }
+    verbose             = true;
+    verbosity_supported = true;
+    const auto info = get_storage_info(dev, 0);
+    set_storage(*type, info ? get_sector_bytes(*type, *info) : 0);
+    return true;
+}
+
+auto get_storage_info(Device& dev, const size_t disk) -> std::optional<StorageInfo> {
+    const auto node =
+        xml::Node{
+            .name = "data",
+        }
+            .append_children({
+                xml::Node{.name = "getstorageinfo"}
+                    .append_attrs({
+                        {"physical_partition_number", std::to_string(disk)},
+                    }),
+            });
+    const auto payload = xml_header + xml::deparse(node);
+    ensure(dev.write(payload.data(), payload.size()), "failed to send command");
+
+    auto info = StorageInfo();
+    while(true) {
+        unwrap(xml, receive_xml(dev));
+        for(const auto& node : xml) {
+            if(node.key == "response") {
+                ensure(node.value == "ACK", "getstorageinfo failed");
+                ensure(info.block_size != 0 || info.page_size != 0, "programmer did not report the sector size");
+                return info;
+            }
+            if(node.key != "log") {
+                continue;
+            }
+            // the json may arrive with escaped quotes
+            auto log = node.value;
+            for(auto pos = log.find("&quot;"); pos != log.npos; pos = log.find("&quot;", pos + 1)) {
+                log.replace(pos, 6, "\"");
+            }
+            if(const auto v = find_info_value(log, "\"mem_type\""); !v.empty()) {
+                info.mem_type = v;
+            }
+            if(const auto v = find_info_value(log, "\"block_size\""); !v.empty()) {
+                info.block_size = parse_info_number(v);
+            } else if(const auto v = find_info_value(log, "Block Size in Bytes"); !v.empty()) {
+                info.block_size = parse_info_number(v);
+            }
+            if(const auto v = find_info_value(log, "\"page_size\""); !v.empty()) {
+                info.page_size = parse_info_number(v);
+            }
+            if(const auto v = find_info_value(log, "\"total_blocks\""); !v.empty()) {
+                info.total_blocks = parse_info_number(v);
+            } else if(const auto v = find_info_value(log, "Total Logical Blocks"); !v.empty()) {
+                info.total_blocks = parse_info_number(v);
+            }
+            if(const auto v = find_info_value(log, "\"num_physical\""); !v.empty()) {
+                info.num_physical = parse_info_number(v);
+            } else if(const auto v = find_info_value(log, "Total Physical Partitions"); !v.empty()) {
+                info.num_physical = parse_info_number(v);
+            }
+        }
+    }
+}
+
+auto load_storage_info(Device& dev) -> bool {
+    unwrap(info, get_storage_info(dev, 0));
+    auto type = find_storage_type(info.mem_type);
+    if(type == nullptr) {
+        // older programmers do not name the type, eMMC is the one with small sectors
+        type = &storage_types[info.block_size == 512 ? 1 : 0];
+    }
+    set_storage(*type, get_sector_bytes(*type, info));
+    verbose             = std::nullopt;
+    verbosity_supported = true;
     return true;
 }
 
@@ -237,75 +565,113 @@ auto send_reset(Device& dev) -> bool {
     exit(0);
 }
 
-auto read_disk(Device& dev, const size_t disk, const size_t sector_begin, const size_t num_sectors, std::byte* const output_buffer) -> bool {
+namespace {
+constexpr auto max_read_bytes = 16uz * 1024 * 1024; // Device::read takes an int
+
+// the sector size as a type, so that the common sizes get constant arithmetic
+template <size_t bytes>
+struct FixedSector {
+    static constexpr auto size = bytes;
+};
+
+struct RuntimeSector {
+    size_t size;
+};
+
+template <class F>
+auto with_sector(F&& f) -> bool {
+    switch(bytes_per_sector) {
+    case 512:
+        return f(FixedSector<512>());
+    case 4096:
+        return f(FixedSector<4096>());
+    default:
+        return f(RuntimeSector{bytes_per_sector});
+    }
+}
+
+template <class Sector>
+auto read_command(Device& dev, const size_t disk, const size_t sector_begin, const size_t num_sectors, std::byte* const output_buffer, const Sector sector) -> bool {
     ensure(send_rw_command(dev, disk, sector_begin, num_sectors, "read"));
     if(config::debug_firehose_disk_io) {
         PRINT("read ready");
     }
 
-    auto bytes_left = num_sectors * bytes_per_sector;
-    auto ack_str    = std::string_view(); // sometimes ack is included in data packet
-    auto buf        = std::array<std::byte, 4096>();
+    // received straight into the caller's buffer, never asking for more than the payload,
+    // so the ack that follows stays in the device for wait_for_ack
+    const auto bytes      = num_sectors * sector.size;
+    auto       bytes_left = bytes;
     while(bytes_left > 0) {
-        const auto size = dev.read(buf.data(), buf.size());
+        const auto size = dev.read(output_buffer + bytes - bytes_left, int(std::min(bytes_left, max_read_bytes)));
         ensure(size > 0, "failed to receive dump data");
-        const auto bytes_to_read = std::min(size_t(size), bytes_left);
-        memcpy(output_buffer + num_sectors * bytes_per_sector - bytes_left, buf.data(), bytes_to_read);
-        if(size_t(size) > bytes_left) {
-            ack_str = std::string_view(std::bit_cast<char*>(buf.data()) + bytes_left, size - bytes_to_read);
-        }
-        bytes_left -= bytes_to_read;
+        bytes_left -= size;
         if(config::debug_firehose_disk_io) {
             PRINT("{} bytes received, remain {} bytes", size, bytes_left);
         }
     }
 
-    if(!ack_str.empty()) {
-        unwrap(xml, parse_xml(ack_str));
-        if(const auto r = find_response(xml); !r.empty()) {
-            ensure(r == "ACK", "cannot read done ack");
-            goto end;
-        }
-    }
-
     ensure(wait_for_ack(dev), "cannot read done ack");
 
-end:
     if(config::debug_firehose_disk_io) {
         PRINT("read done");
     }
     return true;
 }
+} // namespace
+
+auto read_to_path(Device& dev, const size_t disk, const size_t sector_begin, const size_t num_sectors, const std::string_view path) -> bool {
+    const auto args = RWArgs{disk, sector_begin, num_sectors, path};
+    if(edlz::is_image_path(path)) {
+        auto writer = edlz::Writer();
+        ensure(writer.open(path, num_sectors * bytes_per_sector));
+        ensure(read_to_writer(dev, args, writer));
+    } else if(cas::is_manifest_path(path)) {
+        auto writer = cas::Writer();
+        ensure(writer.open(path, num_sectors * bytes_per_sector));
+        ensure(read_to_writer(dev, args, writer));
+    } else {
+        // declared first, so that the writer is stopped before the journal is flushed
+        // and opened first, the journal checks the file before the writer creates or resizes it
+        auto resume = std::optional<Resume>();
+        if(is_resumable_path(path)) {
+            ensure(resume.emplace().open(args, TransferJournal::Kind::Read, config::file_buffer_bytes));
+        }
+        auto writer = FileWriter();
+        ensure(writer.open(path, num_sectors * bytes_per_sector));
+        if(resume) {
+            writer.on_written = [&resume](const size_t offset, const size_t /*size*/) {
+                return resume->journal.mark_done(offset / config::file_buffer_bytes);
+            };
+        }
+        ensure(read_to_writer(dev, args, writer, resume ? &*resume : nullptr));
+        if(resume) {
+            ensure(resume->journal.remove());
+        }
+    }
+    return true;
+}
 
 auto read_to_file(Device& dev, const std::string_view args_str) -> bool {
     auto args = RWArgs();
     ensure(parse_rw_args(args_str, args));
-
-    const auto total_bytes = args.num_sectors * fh::bytes_per_sector;
-    const auto output_fd   = open(std::string(args.file).data(), O_RDWR | O_CREAT, 0644);
-    ensure(output_fd >= 0);
-    ensure(ftruncate(output_fd, total_bytes) == 0);
-    const auto output_buf = mmap(NULL, total_bytes, PROT_WRITE, MAP_SHARED, output_fd, 0);
-    ensure(output_buf != MAP_FAILED);
-
-    read_disk(dev, args.disk, args.sector_begin, args.num_sectors, std::bit_cast<std::byte*>(output_buf));
-
-    ensure(close(output_fd) == 0);
-    ensure(munmap(output_buf, total_bytes) == 0);
+    ensure(read_to_path(dev, args.disk, args.sector_begin, args.num_sectors, args.file));
     return true;
 }
 
-auto write_disk(Device& dev, const size_t disk, const size_t sector_begin, const size_t num_sectors, const std::byte* input_buffer) -> bool {
-    ensure(!config::disk_read_only, "read only disk");
-
+namespace {
+template <class Sector>
+auto program_command(Device& dev, const size_t disk, const size_t sector_begin, const size_t num_sectors, const std::byte* input_buffer, const Sector sector) -> bool {
     ensure(send_rw_command(dev, disk, sector_begin, num_sectors, "program"));
     if(config::debug_firehose_disk_io) {
         PRINT("write ready");
     }
 
-    auto bytes_left = num_sectors * bytes_per_sector;
+    // as many whole sectors as fit in a payload
+    const auto packet_bytes = std::max(max_payload_bytes / sector.size, 1uz) * sector.size;
+
+    auto bytes_left = num_sectors * sector.size;
     while(bytes_left > 0) {
-        const auto bytes_to_write = size_t(bytes_per_sector);
+        const auto bytes_to_write = std::min(packet_bytes, bytes_left);
         ensure(dev.write(input_buffer, bytes_to_write), "failed to write data: ", strerror(errno));
         input_buffer += bytes_to_write;
         bytes_left -= bytes_to_write;
@@ -320,21 +686,9 @@ auto write_disk(Device& dev, const size_t disk, const size_t sector_begin, const
     auto dummy = char(' ');
     dev.write(&dummy, 1);
     auto step = 0;
-    while(step < 3) {
+    while(step < write_done_steps) {
         unwrap(xml, receive_xml(dev));
-        for(const auto& node : xml) {
-            if(step == 0) {
-                if(node.key == "response") {
-                    ensure(node.value == "ACK", "cannot read done ack");
-                    step = 1;
-                }
-            } else {
-                if(node.key == "log" && node.value.starts_with("ERROR")) {
-                    // this packet is caused by the dummy input
-                    step += 1;
-                }
-            }
-        }
+        ensure(update_write_done_step(xml, step), "cannot read done ack");
     }
 
     if(config::debug_firehose_disk_io) {
@@ -342,21 +696,317 @@ auto write_disk(Device& dev, const size_t disk, const size_t sector_begin, const
     }
     return true;
 }
+} // namespace
+
+namespace {
+auto bad_maps = std::vector<scan::BadMap>();
+
+auto find_bad_range(const size_t disk, const size_t sector_begin, const size_t num_sectors) -> const scan::Range* {
+    for(const auto& map : bad_maps) {
+        if(map.disk == disk) {
+            return map.find(sector_begin, num_sectors);
+        }
+    }
+    return nullptr;
+}
+} // namespace
+
+auto set_bad_map(scan::BadMap map) -> bool {
+    ensure(map.sector_bytes == bytes_per_sector, "bad range map is for {} byte sectors", map.sector_bytes);
+    std::println("disk {}: {} bad sectors in {} ranges", map.disk, map.get_bad_sectors(), map.ranges.size());
+    clear_bad_map(map.disk);
+    bad_maps.push_back(std::move(map));
+    return true;
+}
+
+auto clear_bad_map(const size_t disk) -> void {
+    std::erase_if(bad_maps, [disk](const scan::BadMap& map) { return map.disk == disk; });
+}
+
+auto read_disk(Device& dev, const size_t disk, const size_t sector_begin, const size_t num_sectors, std::byte* const output_buffer) -> bool {
+    // a known bad sector would stall the programmer on retries
+    if(const auto bad = find_bad_range(disk, sector_begin, num_sectors); bad != nullptr) {
+        std::println("sectors {}+{} are in the bad range map", bad->begin, bad->count);
+        return false;
+    }
+    return with_sector([&](const auto sector) -> bool {
+        for(auto done = 0uz; done < num_sectors;) {
+            const auto sectors = read_tuner.get_sectors(num_sectors - done);
+            const auto begin   = std::chrono::steady_clock::now();
+            if(!read_command(dev, disk, sector_begin + done, sectors, output_buffer + done * sector.size, sector)) {
+                // the logs of what follows are worth having
+                set_verbose(dev, true);
+                return false;
+            }
+            read_tuner.record(sectors, std::chrono::steady_clock::now() - begin);
+            save_tuning_if_changed();
+            done += sectors;
+        }
+        return true;
+    });
+}
+
+namespace {
+auto program_disk(Device& dev, const size_t disk, const size_t sector_begin, const size_t num_sectors, const std::byte* const input_buffer) -> bool {
+    // the done handshake of program counts the ERROR logs caused by the dummy byte,
+    // a programmer configured with Verbose=0 is not known to send them, so programs are never quiet
+    // an unknown verbosity stays trusted only if the programmer rejects the reconfigure, then it cannot have been lowered
+    const auto loud = VerbosityScope(dev, true);
+    ensure(get_verbose().value_or(true), "cannot program with lowered verbosity");
+    return with_sector([&](const auto sector) -> bool {
+        for(auto done = 0uz; done < num_sectors;) {
+            const auto sectors = program_tuner.get_sectors(num_sectors - done);
+            const auto begin   = std::chrono::steady_clock::now();
+            if(!program_command(dev, disk, sector_begin + done, sectors, input_buffer + done * sector.size, sector)) {
+                set_verbose(dev, true);
+                return false;
+            }
+            program_tuner.record(sectors, std::chrono::steady_clock::now() - begin);
+            save_tuning_if_changed();
+            done += sectors;
+        }
+        return true;
+    });
+}
+
+// returns whether the erased run now holds value, if not it has to be programmed
+// the first erase of a session reads both ends of the run back to learn what erasing leaves behind
+auto erase_fill_run(Device& dev, const size_t disk, const size_t sector_begin, const size_t num_sectors, const std::byte value) -> bool {
+    if(!erase_disk(dev, disk, sector_begin, num_sectors)) {
+        std::println("erase failed, programming fill runs instead");
+        erased_probed = true;
+        erased_value  = std::nullopt;
+        return false;
+    }
+    if(erased_probed) {
+        return erased_value == value;
+    }
+
+    const auto buf = pool::acquire(bytes_per_sector);
+    if(buf.empty()) {
+        return false;
+    }
+    auto probed = std::optional<std::byte>();
+    for(const auto sector : {sector_begin, sector_begin + num_sectors - 1}) {
+        const auto read = with_sector([&](const auto s) { return read_command(dev, disk, sector, 1, buf.data(), s); });
+        if(!read || !fill::is_filled(buf.data(), bytes_per_sector, probed.value_or(buf.data()[0]))) {
+            probed = std::nullopt;
+            break;
+        }
+        probed = buf.data()[0];
+    }
+    erased_probed = true;
+    erased_value  = probed;
+    if(probed) {
+        std::println("erased sectors read as 0x{:02x}", int(*probed));
+    } else {
+        std::println("erased sectors are not uniform, programming fill runs instead");
+    }
+    return erased_value == value;
+}
+} // namespace
+
+auto read_disk_around_bad(Device& dev, const size_t disk, const size_t sector_begin, const size_t num_sectors, std::byte* const output_buffer) -> bool {
+    const auto end = sector_begin + num_sectors;
+    for(auto sector = sector_begin; sector < end;) {
+        const auto bad      = find_bad_range(disk, sector, end - sector);
+        const auto good_end = bad != nullptr ? std::max(bad->begin, sector) : end;
+        if(good_end > sector) {
+            ensure(read_disk(dev, disk, sector, good_end - sector, output_buffer + (sector - sector_begin) * bytes_per_sector));
+        }
+        if(bad == nullptr) {
+            break;
+        }
+        const auto bad_end = std::min(bad->begin + bad->count, end);
+        std::fill(output_buffer + (good_end - sector_begin) * bytes_per_sector, output_buffer + (bad_end - sector_begin) * bytes_per_sector, std::byte(0));
+        std::println("sectors {}+{} are in the bad range map, filled with zeros", good_end, bad_end - good_end);
+        sector = bad_end;
+    }
+    return true;
+}
+
+auto write_disk(Device& dev, const size_t disk, const size_t sector_begin, const size_t num_sectors, const std::byte* const input_buffer, const bool skip_fill_runs) -> bool {
+    ensure(!config::disk_read_only, "read only disk");
+
+    // nand erases whole blocks, which may hold data next to the run
+    const auto erase       = config::erase_fill_runs && storage != Storage::NAND && !(erased_probed && !erased_value);
+    const auto unit        = config::erase_unit_sectors;
+    const auto min_sectors = std::max(config::fill_run_min_bytes / bytes_per_sector, unit);
+    if(!erase && !skip_fill_runs) {
+        return program_disk(dev, disk, sector_begin, num_sectors, input_buffer);
+    }
+
+    auto done = 0uz; // sectors before this are programmed, erased or skipped
+    for(const auto& run : fill::find_runs(input_buffer, bytes_per_sector, num_sectors, min_sectors)) {
+        auto begin = run.begin;
+        auto end   = run.begin + run.count;
+        if(!skip_fill_runs) {
+            if(erased_probed && erased_value != run.value) {
+                continue;
+            }
+            // erase works on whole units, the unaligned ends are programmed
+            begin = (sector_begin + begin + unit - 1) / unit * unit - sector_begin;
+            end   = (sector_begin + end) / unit * unit - sector_begin;
+            if(begin >= end) {
+                continue;
+            }
+        }
+        ensure(program_disk(dev, disk, sector_begin + done, begin - done, input_buffer + done * bytes_per_sector));
+        if(!skip_fill_runs && !erase_fill_run(dev, disk, sector_begin + begin, end - begin, run.value)) {
+            ensure(program_disk(dev, disk, sector_begin + begin, end - begin, input_buffer + begin * bytes_per_sector));
+        }
+        if(config::debug_firehose_disk_io) {
+            PRINT("{} {}+{} of 0x{:02x}", skip_fill_runs ? "skipped" : "handled", sector_begin + begin, end - begin, int(run.value));
+        }
+        done = end;
+    }
+    return program_disk(dev, disk, sector_begin + done, num_sectors - done, input_buffer + done * bytes_per_sector);
+}
 
 auto write_from_file(Device& dev, std::string_view args_str) -> bool {
     auto args = RWArgs();
     ensure(parse_rw_args(args_str, args));
 
-    const auto total_bytes = args.num_sectors * fh::bytes_per_sector;
-    const auto input_fd    = open(std::string(args.file).data(), O_RDONLY);
-    ensure(input_fd >= 0);
-    const auto input_buf = mmap(NULL, total_bytes, PROT_READ, MAP_PRIVATE, input_fd, 0);
-    ensure(input_buf != MAP_FAILED);
+    if(edlz::is_image_path(args.file)) {
+        auto reader = edlz::Reader();
+        ensure(reader.open(args.file));
+        ensure(write_from_image(dev, args, reader, config::compress_chunk_bytes));
+        return true;
+    }
+    if(cas::is_manifest_path(args.file)) {
+        auto reader = cas::Reader();
+        ensure(reader.open(args.file));
+        ensure(write_from_image(dev, args, reader, config::dedup_chunk_bytes));
+        return true;
+    }
+
+    auto reader   = FileReader();
+    auto verifier = WriteVerifier(dev, args);
+    auto resume   = std::optional<Resume>();
+    ensure(reader.open(args.file, args.num_sectors * bytes_per_sector));
+    if(is_resumable_path(args.file)) {
+        ensure(resume.emplace().open(args, TransferJournal::Kind::Write, config::file_buffer_bytes));
+    }
+    for(auto sector = 0uz; sector < args.num_sectors;) {
+        const auto buf = reader.acquire();
+        ensure(!buf.empty(), "failed to read input");
+        const auto sectors = buf.size() / bytes_per_sector;
+        if(!resume || !resume->is_done(sector)) {
+            ensure(write_disk(dev, args.disk, args.sector_begin + sector, sectors, buf.data(), verifier.skip_fill_runs()));
+            if(resume) {
+                ensure(resume->journal.mark_done(sector / resume->chunk_sectors));
+            }
+        }
+        verifier.update(buf.data(), sectors);
+        reader.release();
+        sector += sectors;
+    }
+    ensure(reader.finish());
+    ensure(verifier.finish(dev, args));
+    if(resume) {
+        ensure(resume->journal.remove());
+    }
+    return true;
+}
+
+auto erase_disk(Device& dev, const size_t disk, const size_t sector_begin, const size_t num_sectors) -> bool {
+    ensure(!config::disk_read_only, "read only disk");
+
+    // erase has no data phase, the first ack is sent after the erase completed
+    ensure(send_rw_command(dev, disk, sector_begin, num_sectors, "erase"));
+    if(config::debug_firehose_disk_io) {
+        PRINT("erased {}+{}", sector_begin, num_sectors);
+    }
+    return true;
+}
+
+auto get_sha256_digest(Device& dev, const size_t disk, const size_t sector_begin, const size_t num_sectors) -> std::optional<sha256::Digest> {
+    // "Digest 0123...cdef"
+    static const auto prefix = std::string_view("Digest ");
+
+    const auto node =
+        xml::Node{
+            .name = "data",
+        }
+            .append_children({
+                xml::Node{.name = "getsha256digest"}
+                    .append_attrs({
+                        {"SECTOR_SIZE_IN_BYTES", std::to_string(fh::bytes_per_sector)},
+                        {"num_partition_sectors", std::to_string(num_sectors)},
+                        {"physical_partition_number", std::to_string(disk)},
+                        {"start_sector", std::to_string(sector_begin)},
+                    }),
+            });
+    const auto payload = xml_header + xml::deparse(node);
+    ensure(dev.write(payload.data(), payload.size()), "failed to send command");
+
+    auto digest = std::optional<sha256::Digest>();
+    while(true) {
+        unwrap(xml, receive_xml(dev));
+        for(const auto& node : xml) {
+            if(node.key == "response") {
+                ensure(node.value == "ACK", "digest command failed");
+                ensure(digest, "programmer did not report digest");
+                return digest;
+            }
+            if(node.key != "log" || !node.value.starts_with(prefix)) {
+                continue;
+            }
+            digest = sha256::from_hex(std::string_view(node.value).substr(prefix.size()));
+            ensure(digest);
+        }
+    }
+}
 
-    write_disk(dev, args.disk, args.sector_begin, args.num_sectors, std::bit_cast<std::byte*>(input_buf));
+auto verify_digests(Device& dev, const checksum::Manifest& manifest) -> bool {
+    // the digests arrive as logs
+    const auto loud = VerbosityScope(dev, true);
+    auto mismatches = 0uz;
+    for(auto i = 0uz; i < manifest.digests.size(); i += 1) {
+        const auto sector  = i * manifest.chunk_sectors;
+        const auto sectors = std::min(manifest.chunk_sectors, manifest.num_sectors - sector);
+        unwrap(digest, get_sha256_digest(dev, manifest.disk, manifest.sector_begin + sector, sectors));
+        if(digest != manifest.digests[i]) {
+            std::println("digest mismatch at sector {}+{}", manifest.sector_begin + sector, sectors);
+            mismatches += 1;
+        }
+    }
+    ensure(mismatches == 0, "{} of {} chunks differ", mismatches, manifest.digests.size());
+    std::println("verified {} sectors", manifest.num_sectors);
+    return true;
+}
 
-    ensure(close(input_fd) == 0);
-    ensure(munmap(input_buf, total_bytes) == 0);
+auto verify_file(Device& dev, const std::string_view path) -> bool {
+    unwrap(manifest, checksum::read_manifest(path));
+    ensure(verify_digests(dev, manifest));
     return true;
 }
+
+auto assume_total_sectors(Device& dev, const size_t disk) -> size_t {
+    auto current  = 1024uz * 1024 * 4 / bytes_per_sector; // 4MiB
+    auto null_buf = std::vector<std::byte>(bytes_per_sector);
+    while(true) {
+        if(read_disk(dev, disk, current, 1, null_buf.data())) {
+            current *= 2;
+        } else {
+            break;
+        }
+    }
+    current /= 2;
+    auto step = current / 2;
+    while(true) {
+        if(read_disk(dev, disk, current, 1, null_buf.data())) {
+            if(step == 0) {
+                return current + 1;
+            }
+            current += step;
+        } else {
+            if(step == 0) {
+                return current;
+            }
+            current -= step;
+        }
+        step /= 2;
+    }
+}
 } // namespace fh
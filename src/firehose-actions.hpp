@@ -1,20 +1,90 @@
 #pragma once
+#include <optional>
+#include <string>
 #include <string_view>
 
 #include "abstract-device.hpp"
+#include "checksum.hpp"
+#include "media-scan.hpp"
+#include "sha256.hpp"
 
 namespace fh {
-constexpr auto bytes_per_sector = 0x1000;
+enum class Storage {
+    UFS,
+    eMMC,
+    NAND,
+};
 
-// TODO: implement getstorageinfo
-// <?xml version="1.0"?><data><getstorageinfo /></data>
-// <?xml version="1.0"?><data><getstorageinfo physical_partition_number="1"/></data>
+// storage of the current session, chosen by send_configure or load_storage_info
+// sector sizes of 512 and 4096 bytes take specialized transfer paths
+inline auto storage          = Storage::UFS;
+inline auto bytes_per_sector = 0x1000uz;
+
+// reported by getstorageinfo, zero if the programmer did not tell
+struct StorageInfo {
+    std::string mem_type;
+    size_t      block_size;
+    size_t      page_size;
+    size_t      total_blocks;
+    size_t      num_physical;
+};
+
+struct RWArgs {
+    size_t           disk;
+    size_t           sector_begin;
+    size_t           num_sectors;
+    std::string_view file;
+};
+
+// "disk sector_begin num_sectors file", file may contain spaces (e.g. "|zstd -o dump.zst")
+auto parse_rw_args(std::string_view str, RWArgs& args) -> bool;
 
 auto send_nop(Device& dev) -> bool;
+auto get_chip_serial(Device& dev) -> std::optional<std::string>;
+// identifies the device model and restores the command sizes the autotuner chose for it in a previous session
+auto load_tuning(Device& dev) -> bool;
+// tries config::memory_name, or UFS, eMMC and NAND in turn, and sets the session storage to the accepted one
 auto send_configure(Device& dev) -> bool;
+auto get_storage_info(Device& dev, size_t disk) -> std::optional<StorageInfo>;
+// the programmer's Verbose setting, changed by configuring again without storage init
+// transfers lower it with config::quiet_transfers and raise it again when a command fails
+// nullopt for a programmer configured by an earlier session, which may have left it lowered
+auto get_verbose() -> std::optional<bool>;
+auto set_verbose(Device& dev, bool verbose) -> bool;
+
+// sets the programmer's verbosity while alive and restores it afterwards, a verbosity that was
+// not known is restored as raised. lowering only happens with config::quiet_transfers
+class VerbosityScope {
+  private:
+    Device* dev      = nullptr;
+    bool    previous = true;
+
+  public:
+    VerbosityScope(Device& dev, bool verbose);
+    VerbosityScope(const VerbosityScope&) = delete;
+    ~VerbosityScope();
+};
+// sets the session storage from getstorageinfo, for programmers configured by an earlier session
+auto load_storage_info(Device& dev) -> bool;
 auto send_reset(Device& dev) -> bool;
+// fails without asking the device if the sectors are in the bad range map of the disk
 auto read_disk(Device& dev, size_t disk, size_t sector_begin, size_t num_sectors, std::byte* output_buffer) -> bool;
+// reads around the bad ranges of the map, their sectors read as zero
+auto read_disk_around_bad(Device& dev, size_t disk, size_t sector_begin, size_t num_sectors, std::byte* output_buffer) -> bool;
+// bad range maps of the session, one per disk, see media-scan.hpp
+auto set_bad_map(scan::BadMap map) -> bool;
+auto clear_bad_map(size_t disk) -> void;
+auto read_to_path(Device& dev, size_t disk, size_t sector_begin, size_t num_sectors, std::string_view path) -> bool;
 auto read_to_file(Device& dev, std::string_view args) -> bool;
-auto write_disk(Device& dev, size_t disk, size_t sector_begin, size_t num_sectors, const std::byte* input_buffer) -> bool;
+// runs of 0x00 or 0xff of at least config::fill_run_min_bytes are erased instead of programmed, see fill-runs.hpp
+// skip_fill_runs leaves them out altogether, for callers that verify the result
+auto write_disk(Device& dev, size_t disk, size_t sector_begin, size_t num_sectors, const std::byte* input_buffer, bool skip_fill_runs = false) -> bool;
 auto write_from_file(Device& dev, std::string_view args) -> bool;
+auto erase_disk(Device& dev, size_t disk, size_t sector_begin, size_t num_sectors) -> bool;
+auto get_sha256_digest(Device& dev, size_t disk, size_t sector_begin, size_t num_sectors) -> std::optional<sha256::Digest>;
+// compares each chunk with the digest computed by the device, no data is transferred
+auto verify_digests(Device& dev, const checksum::Manifest& manifest) -> bool;
+auto verify_file(Device& dev, std::string_view path) -> bool;
+// finds the lun size by probing reads
+auto assume_total_sectors(Device& dev, size_t disk) -> size_t;
 } // namespace fh
@@ -0,0 +1,227 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "abstract-device.hpp"
+#include "firehose-corpus.hpp"
+#include "firehose-xml.hpp"
+#include "macros/unwrap.hpp"
+#include "util/charconv.hpp"
+#include "xml/xml.hpp"
+
+// throughput of the firehose response path over fh::corpus, and a framing check that splits
+// every stream at every byte
+namespace {
+auto allocations = size_t(0);
+
+class ReplayDevice : public Device {
+  private:
+    std::string_view stream;
+    size_t           pos   = 0;
+    size_t           split = 0; // no read crosses this offset, 0 = none
+
+  public:
+    auto clear_rx_buffer() -> bool override {
+        return true;
+    }
+
+    auto write(const void* const /*ptr*/, const int /*size*/) -> bool override {
+        return true;
+    }
+
+    auto read(void* const ptr, const int size) -> int override {
+        auto len = std::min(size_t(size), stream.size() - pos);
+        if(pos < split) {
+            len = std::min(len, split - pos);
+        }
+        memcpy(ptr, stream.data() + pos, len);
+        pos += len;
+        return len;
+    }
+
+    auto read_struct(void* const ptr, const int size) -> bool override {
+        for(auto done = 0; done < size;) {
+            const auto ret = read(static_cast<std::byte*>(ptr) + done, size - done);
+            if(ret <= 0) {
+                return false;
+            }
+            done += ret;
+        }
+        return true;
+    }
+
+    auto wait_readable(const int /*timeout_ms*/) -> bool override {
+        return !at_end();
+    }
+
+    auto reset() -> void {
+        pos = 0;
+    }
+
+    auto at_end() const -> bool {
+        return pos == stream.size();
+    }
+
+    ReplayDevice(const std::string_view stream, const size_t split = 0) : stream(stream), split(split) {}
+};
+
+auto count_documents(const std::string_view str) -> size_t {
+    auto count = 0uz;
+    for(auto pos = str.find("<?xml"); pos != str.npos; pos = str.find("<?xml", pos + 1)) {
+        count += 1;
+    }
+    return count;
+}
+
+// the <data> elements, as parse_xml hands them to xml::parse
+auto split_bodies(std::string_view str) -> std::vector<std::string_view> {
+    auto r = std::vector<std::string_view>();
+    while(!str.empty()) {
+        const auto header_end = str.find("?>");
+        const auto body_begin = str.find('<', header_end);
+        const auto next       = str.find("<?xml", body_begin);
+        const auto body_end   = next != str.npos ? next : str.size();
+        r.push_back(str.substr(body_begin, body_end - body_begin));
+        str.remove_prefix(body_end);
+    }
+    return r;
+}
+
+auto receive_all(ReplayDevice& dev, const size_t data_bytes) -> std::optional<std::vector<std::vector<fh::ParsedXML>>> {
+    auto data = std::string(data_bytes, '\0');
+    ensure(dev.read_struct(data.data(), data.size()));
+    auto r = std::vector<std::vector<fh::ParsedXML>>();
+    while(!dev.at_end()) {
+        unwrap_mut(xml, fh::receive_xml(dev));
+        r.push_back(std::move(xml));
+    }
+    return r;
+}
+
+auto same_documents(const std::vector<std::vector<fh::ParsedXML>>& a, const std::vector<std::vector<fh::ParsedXML>>& b) -> bool {
+    if(a.size() != b.size()) {
+        return false;
+    }
+    for(auto i = 0uz; i < a.size(); i += 1) {
+        if(!std::ranges::equal(a[i], b[i], [](const fh::ParsedXML& x, const fh::ParsedXML& y) { return x.key == y.key && x.value == y.value; })) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// receives every stream split into two reads at every offset, the documents must not change
+auto check_split_points(const std::vector<fh::corpus::Entry>& entries) -> bool {
+    auto failures = 0uz;
+    for(const auto& entry : entries) {
+        auto whole = ReplayDevice(entry.stream);
+        unwrap(expected, receive_all(whole, entry.data_bytes), "{}: cannot receive", entry.name);
+        for(auto split = 1uz; split < entry.stream.size(); split += 1) {
+            auto       dev    = ReplayDevice(entry.stream, split);
+            const auto result = receive_all(dev, entry.data_bytes);
+            if(!result || !same_documents(*result, expected)) {
+                std::println("{}: framing differs when split at {}", entry.name, split);
+                failures += 1;
+            }
+        }
+    }
+    std::println("split points: {} failures", failures);
+    return failures == 0;
+}
+
+struct Result {
+    double docs_per_sec;
+    double ns_per_doc;
+    double allocs_per_doc;
+};
+
+template <class F>
+auto measure(const double seconds, const size_t docs_per_call, F f) -> Result {
+    ensure(f(), "benchmark failed");
+
+    const auto allocations_begin = allocations;
+    const auto begin             = std::chrono::steady_clock::now();
+    auto       calls             = 0uz;
+    auto       elapsed           = 0.0;
+    do {
+        for(auto i = 0; i < 16; i += 1) {
+            f();
+        }
+        calls += 16;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    } while(elapsed < seconds);
+
+    const auto docs = double(calls * docs_per_call);
+    return Result{docs / elapsed, elapsed * 1e9 / docs, (allocations - allocations_begin) / docs};
+}
+
+auto print_result(const std::string_view entry, const std::string_view function, const Result& result) -> void {
+    std::println("{:<14} {:<14} {:>12.0f} {:>10.1f} {:>10.1f}", entry, function, result.docs_per_sec, result.ns_per_doc, result.allocs_per_doc);
+}
+
+auto run_benchmarks(const std::vector<fh::corpus::Entry>& entries, const double seconds) -> bool {
+    std::println("{:<14} {:<14} {:>12} {:>10} {:>10}", "corpus", "function", "docs/s", "ns/doc", "allocs/doc");
+    for(const auto& entry : entries) {
+        const auto xml    = std::string_view(entry.stream).substr(entry.data_bytes);
+        const auto docs   = count_documents(xml);
+        const auto bodies = split_bodies(xml);
+        unwrap(parsed, fh::parse_xml(xml), "{}: cannot parse", entry.name);
+
+        auto dev = ReplayDevice(entry.stream);
+        print_result(entry.name, "receive_xml", measure(seconds, docs, [&] {
+                         dev.reset();
+                         return receive_all(dev, entry.data_bytes).has_value();
+                     }));
+        print_result(entry.name, "parse_xml", measure(seconds, docs, [&] {
+                         return fh::parse_xml(xml).has_value();
+                     }));
+        print_result(entry.name, "find_response", measure(seconds, docs, [&] {
+                         return !fh::find_response(parsed).empty();
+                     }));
+        print_result(entry.name, "xml::parse", measure(seconds, docs, [&] {
+                         auto ok = true;
+                         for(const auto body : bodies) {
+                             ok &= xml::parse(body).has_value();
+                         }
+                         return ok;
+                     }));
+    }
+    return true;
+}
+} // namespace
+
+auto operator new(const size_t size) -> void* {
+    allocations += 1;
+    if(const auto p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+auto operator delete(void* const ptr) noexcept -> void {
+    std::free(ptr);
+}
+
+auto operator delete(void* const ptr, const size_t /*size*/) noexcept -> void {
+    std::free(ptr);
+}
+
+auto main(const int argc, const char* const argv[]) -> int {
+    constexpr auto usage       = "usage: firehose-bench [MILLISECONDS_PER_CASE]";
+    constexpr auto error_value = 1; // so that a framing regression fails the benchmark run
+
+    auto milliseconds = 200uz;
+    if(argc == 2) {
+        const auto value = from_chars<size_t>(argv[1]);
+        ensure_v(value, "{}", usage);
+        milliseconds = *value;
+    } else {
+        ensure_v(argc == 1, "{}", usage);
+    }
+
+    const auto entries = fh::corpus::make_entries();
+    ensure_v(check_split_points(entries));
+    ensure_v(run_benchmarks(entries, milliseconds / 1000.0));
+    return 0;
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+
+// firehose responses as programmers send them, used by firehose-bench
+namespace fh::corpus {
+struct Entry {
+    std::string_view name;
+    std::string      stream;     // bytes as they arrive from the device
+    size_t           data_bytes; // raw sector data before the first document
+};
+
+constexpr auto ack = std::string_view(R"xml(<?xml version="1.0" encoding="UTF-8" ?>
+<data>
+<response value="ACK" rawmode="false" /></data>)xml");
+
+constexpr auto rawmode_ack = std::string_view(R"xml(<?xml version="1.0" encoding="UTF-8" ?>
+<data>
+<response value="ACK" rawmode="true" /></data>)xml");
+
+constexpr auto nak = std::string_view(R"xml(<?xml version="1.0" encoding="UTF-8" ?>
+<data>
+<log value="ERROR: Failed to read 1 sectors at 0x1dc8000 (Not a valid partition)" /></data><?xml version="1.0" encoding="UTF-8" ?>
+<data>
+<response value="NAK" rawmode="false" /></data>)xml");
+
+constexpr auto configure = std::string_view(R"xml(<?xml version="1.0" encoding="UTF-8" ?>
+<data>
+<log value="INFO: Calling handler for configure" /></data><?xml version="1.0" encoding="UTF-8" ?>
+<data>
+<log value="INFO: Storage type set to value UFS" /></data><?xml version="1.0" encoding="UTF-8" ?>
+<data>
+<response value="ACK" MinVersionSupported="1" MemoryName="UFS" MaxPayloadSizeFromTargetInBytes="4096" MaxPayloadSizeToTargetInBytes="1048576" MaxPayloadSizeToTargetInBytesSupported="1048576" MaxXMLSizeInBytes="4096" Version="1" TargetName="8250" /></data>)xml");
+
+constexpr auto storage_info = std::string_view(R"xml(<?xml version="1.0" encoding="UTF-8" ?>
+<data>
+<log value="INFO: Device Total Logical Blocks: 0x1dc8000" /></data><?xml version="1.0" encoding="UTF-8" ?>
+<data>
+<log value="INFO: Device Block Size in Bytes: 0x1000" /></data><?xml version="1.0" encoding="UTF-8" ?>
+<data>
+<log value="INFO: Device Total Physical Partitions: 0x6" /></data><?xml version="1.0" encoding="UTF-8" ?>
+<data>
+<log value="INFO: {&quot;storage_info&quot;: {&quot;total_blocks&quot;:31227904, &quot;block_size&quot;:4096, &quot;page_size&quot;:4096, &quot;num_physical&quot;:6, &quot;manufacturer_id&quot;:462, &quot;serial_num&quot;:1162105422, &quot;fw_version&quot;:&quot;0300&quot;,&quot;mem_type&quot;:&quot;UFS&quot;,&quot;prod_name&quot;:&quot;KLUDG4UHDC-B0E1&quot;}}" /></data><?xml version="1.0" encoding="UTF-8" ?>
+<data>
+<response value="ACK" rawmode="false" /></data>)xml");
+
+constexpr auto digest = std::string_view(R"xml(<?xml version="1.0" encoding="UTF-8" ?>
+<data>
+<log value="Digest 5a1e7c2f9b0d4e36a8c1f7b2d9e04c6a1b3f5d7e9c2a4b6d8f0e1c3a5b7d9f2e" /></data><?xml version="1.0" encoding="UTF-8" ?>
+<data>
+<log value="INFO: getsha256digest took 0.52 seconds" /></data><?xml version="1.0" encoding="UTF-8" ?>
+<data>
+<response value="ACK" rawmode="false" /></data>)xml");
+
+inline auto make_log_storm(const size_t logs) -> std::string {
+    auto r = std::string();
+    for(auto i = 0uz; i < logs; i += 1) {
+        r += R"xml(<?xml version="1.0" encoding="UTF-8" ?>
+<data>
+<log value="INFO: Finished sector address )xml";
+        r += std::to_string(0x1000 + i * 256);
+        r += R"xml(" /></data>)xml";
+    }
+    r += ack;
+    return r;
+}
+
+// the ack of a read follows the last sector immediately
+inline auto make_data_then_ack(const size_t data_bytes) -> std::string {
+    auto r = std::string(data_bytes, '\xa5');
+    r += ack;
+    return r;
+}
+
+inline auto make_entries() -> std::vector<Entry> {
+    return {
+        {"ack", std::string(ack), 0},
+        {"rawmode-ack", std::string(rawmode_ack), 0},
+        {"nak", std::string(nak), 0},
+        {"configure", std::string(configure), 0},
+        {"storage-info", std::string(storage_info), 0},
+        {"digest", std::string(digest), 0},
+        {"log-storm", make_log_storm(64), 0},
+        {"data-then-ack", make_data_then_ack(4096), 4096},
+    };
+}
+} // namespace fh::corpus
@@ -0,0 +1,66 @@
+#include <mutex>
+
+#include "config.hpp"
+#include "firehose-log.hpp"
+
+namespace fh::log {
+namespace {
+struct Ring {
+    std::vector<std::string> entries;
+    size_t                   head  = 0; // oldest entry
+    size_t                   count = 0;
+    Metrics                  metrics = {};
+    std::mutex               lock;
+
+    auto push(const std::string& log) -> void {
+        if(entries.empty()) {
+            entries.resize(config::firehose_log_entries);
+        }
+        // logs are only counted
+        if(entries.empty()) {
+            return;
+        }
+        if(count == entries.size()) {
+            head = (head + 1) % entries.size();
+            count -= 1;
+            metrics.dropped += 1;
+        }
+        entries[(head + count) % entries.size()] = log;
+        count += 1;
+    }
+};
+
+auto ring = Ring();
+} // namespace
+
+auto record(const std::vector<ParsedXML>& nodes) -> void {
+    auto l = std::unique_lock(ring.lock);
+    ring.metrics.documents += 1;
+    for(const auto& node : nodes) {
+        if(node.key != "log") {
+            continue;
+        }
+        ring.metrics.logs += 1;
+        ring.metrics.log_bytes += node.value.size();
+        ring.metrics.errors += node.value.starts_with("ERROR") ? 1 : 0;
+        ring.push(node.value);
+    }
+}
+
+auto drain() -> std::vector<std::string> {
+    auto l = std::unique_lock(ring.lock);
+    auto r = std::vector<std::string>();
+    r.reserve(ring.count);
+    for(auto i = 0uz; i < ring.count; i += 1) {
+        r.push_back(std::move(ring.entries[(ring.head + i) % ring.entries.size()]));
+    }
+    ring.head  = 0;
+    ring.count = 0;
+    return r;
+}
+
+auto get_metrics() -> Metrics {
+    auto l = std::unique_lock(ring.lock);
+    return ring.metrics;
+}
+} // namespace fh::log
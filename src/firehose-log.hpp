@@ -0,0 +1,23 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "firehose-xml.hpp"
+
+// programmer <log> documents
+// receive_xml records every log into a bounded ring, the oldest entry is overwritten when it is full
+// whoever wants to show them drains the ring, everyone else can ignore logs entirely
+namespace fh::log {
+struct Metrics {
+    size_t documents; // xml documents received
+    size_t logs;      // <log> entries among them
+    size_t log_bytes; // text of those entries
+    size_t errors;    // logs starting with "ERROR"
+    size_t dropped;   // overwritten before they were drained
+};
+
+auto record(const std::vector<ParsedXML>& nodes) -> void;
+// returns the logs recorded since the last drain, oldest first
+auto drain() -> std::vector<std::string>;
+auto get_metrics() -> Metrics;
+} // namespace fh::log
@@ -0,0 +1,120 @@
+#include "abstract-device.hpp"
+#include "firehose-actions.hpp"
+#include "firehose-log.hpp"
+#include "firehose-xml.hpp"
+#include "macros/unwrap.hpp"
+#include "xml/xml.hpp"
+
+namespace fh {
+auto parse_xml(std::string_view str) -> std::optional<std::vector<ParsedXML>> {
+    auto r = std::vector<ParsedXML>();
+    while(!str.empty()) {
+        // remove xml header
+        const auto header_begin = str.find("<?xml");
+        ensure(header_begin != str.npos, "failed to find xml header");
+        const auto header_end = str.find("?>", header_begin);
+        ensure(header_end != str.npos, "failed to find xml header");
+        str.remove_prefix(header_end + 2);
+
+        // find data body
+        const auto body_begin = str.find("<");
+        ensure(body_begin != str.npos, "failed to find xml body");
+        const auto next_header_begin = str.find("<?xml");
+        const auto body_end          = next_header_begin != str.npos ? next_header_begin : str.size();
+        const auto body              = str.substr(body_begin, body_end - body_begin);
+        str.remove_prefix(body_end);
+
+        // parse xml
+        unwrap(node, xml::parse(body));
+        ensure(node.name == "data", "got unknown xml element");
+        for(const auto& c : node.children) {
+            if(const auto value = c.find_attr("value"); !value) {
+                continue;
+            } else {
+                r.push_back(ParsedXML{std::string(c.name), std::string(*value)});
+            }
+        }
+    }
+    return r;
+}
+
+auto receive_xml(Device& dev) -> std::optional<std::vector<ParsedXML>> {
+    auto       buf       = std::string();
+    const auto read_char = [&dev, &buf]() -> bool {
+        constexpr auto error_value = false;
+
+        auto c = char();
+        ensure_v(dev.read(&c, 1) > 0);
+        buf.push_back(c);
+        return true;
+    };
+
+    // read may return less than asked for
+    buf.resize(xml_minimal_size);
+    ensure(dev.read_struct(buf.data(), xml_minimal_size));
+    ensure(buf.starts_with("<?xml"), "not a xml");
+
+    while(true) {
+        const auto tail = std::string_view(buf.data() + buf.size() - xml_end_marker.size());
+        if(tail == xml_end_marker) {
+            break;
+        }
+        ensure(read_char());
+    }
+    unwrap(xml, parse_xml(buf));
+    log::record(xml);
+    return xml;
+}
+
+auto wait_for_ack(Device& dev) -> bool {
+loop:
+    unwrap(xml, receive_xml(dev));
+    if(const auto r = find_response(xml); !r.empty()) {
+        return r == "ACK";
+    }
+    goto loop;
+}
+
+auto find_response(const std::vector<ParsedXML>& nodes) -> std::string_view {
+    for(const auto& r : nodes) {
+        if(r.key == "response") {
+            return r.value;
+        }
+    }
+    return {};
+}
+
+auto build_rw_command(const size_t disk, const size_t sector_begin, const size_t num_sectors, const char* const command) -> std::string {
+    const auto node =
+        xml::Node{
+            .name = "data",
+        }
+            .append_children({
+                xml::Node{.name = command}
+                    .append_attrs({
+                        {"SECTOR_SIZE_IN_BYTES", std::to_string(fh::bytes_per_sector)},
+                        {"num_partition_sectors", std::to_string(num_sectors)},
+                        {"physical_partition_number", std::to_string(disk)},
+                        {"start_sector", std::to_string(sector_begin)},
+                    }),
+            });
+    return xml_header + xml::deparse(node);
+}
+
+auto update_write_done_step(const std::vector<ParsedXML>& xml, int& step) -> bool {
+    for(const auto& node : xml) {
+        if(step == 0) {
+            if(node.key == "response") {
+                ensure(node.value == "ACK");
+                step = 1;
+            }
+        } else {
+            if(node.key == "log" && node.value.starts_with("ERROR")) {
+                // this packet is caused by the dummy input
+                step += 1;
+            }
+        }
+    }
+    return true;
+}
+} // namespace fh
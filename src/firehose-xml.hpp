@@ -0,0 +1,35 @@
+#pragma once
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class Device;
+
+// xml framing of firehose responses, shared by firehose-actions and firehose-bench
+namespace fh {
+inline const auto xml_header = std::string(R"(<?xml version="1.0"?>)");
+
+// every document ends with this and is at least as long as the smallest one
+constexpr auto xml_end_marker   = std::string_view("</data>");
+constexpr auto xml_minimal_size = std::string_view(R"(<?xml version="1.0" encoding="UTF-8"?><data></data>)").size();
+
+// write_disk sends a dummy byte after the data, see update_write_done_step
+constexpr auto write_done_steps = 3;
+
+struct ParsedXML {
+    std::string key;
+    std::string value;
+};
+
+auto parse_xml(std::string_view str) -> std::optional<std::vector<ParsedXML>>;
+// reads exactly one document, its logs are recorded in fh::log
+auto receive_xml(Device& dev) -> std::optional<std::vector<ParsedXML>>;
+// skips documents until a response arrives, returns whether it was ACK
+auto wait_for_ack(Device& dev) -> bool;
+auto find_response(const std::vector<ParsedXML>& nodes) -> std::string_view;
+auto build_rw_command(size_t disk, size_t sector_begin, size_t num_sectors, const char* command) -> std::string;
+// advances step towards write_done_steps: the program ack, then the two errors caused by the dummy byte
+// returns false if the program was not acknowledged
+auto update_write_done_step(const std::vector<ParsedXML>& xml, int& step) -> bool;
+} // namespace fh
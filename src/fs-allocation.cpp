@@ -0,0 +1,319 @@
+#include <algorithm>
+#include <cstring>
+
+#include "firehose-actions.hpp"
+#include "fs-allocation.hpp"
+#include "macros/unwrap.hpp"
+
+namespace fsalloc {
+namespace {
+// both filesystems are little endian, as are the hosts we run on
+template <class T>
+auto load(const std::vector<std::byte>& buf, const size_t offset) -> T {
+    auto v = T();
+    memcpy(&v, buf.data() + offset, sizeof(T));
+    return v;
+}
+
+struct PartitionReader {
+    Device* dev;
+    size_t  disk;
+    size_t  sector_begin;
+    size_t  num_sectors;
+
+    auto read(const uint64_t offset, const size_t size) -> std::optional<std::vector<std::byte>> {
+        const auto first = offset / fh::bytes_per_sector;
+        const auto last  = (offset + size + fh::bytes_per_sector - 1) / fh::bytes_per_sector;
+        ensure(last <= num_sectors, "read beyond the partition");
+        auto buf = std::vector<std::byte>((last - first) * fh::bytes_per_sector);
+        ensure(fh::read_disk(*dev, disk, sector_begin + first, last - first, buf.data()));
+        buf.erase(buf.begin(), buf.begin() + (offset - first * fh::bytes_per_sector));
+        buf.resize(size);
+        return buf;
+    }
+};
+
+// allocation state per filesystem block
+struct Allocation {
+    uint64_t          block_size;
+    std::vector<bool> used;
+
+    auto mark(const uint64_t block, const uint64_t count) -> void {
+        const auto end = std::min(block + count, uint64_t(used.size()));
+        for(auto i = block; i < end; i += 1) {
+            used[i] = true;
+        }
+    }
+};
+
+namespace ext4 {
+constexpr auto magic                = 0xEF53;
+constexpr auto compat_sparse_super2 = 0x0200;
+constexpr auto incompat_meta_bg     = 0x0010;
+constexpr auto incompat_64bit       = 0x0080;
+constexpr auto ro_compat_sparse     = 0x0001;
+constexpr auto ro_compat_bigalloc   = 0x0200;
+constexpr auto bg_block_uninit      = 0x0002;
+
+struct Group {
+    uint64_t block_bitmap;
+    uint64_t inode_bitmap;
+    uint64_t inode_table;
+    uint16_t flags;
+};
+
+auto is_power_of(uint64_t n, const uint64_t base) -> bool {
+    while(n > 1 && n % base == 0) {
+        n /= base;
+    }
+    return n == 1;
+}
+
+// sb is the 1024 byte superblock
+auto read_allocation(PartitionReader& part, const std::vector<std::byte>& sb) -> std::optional<Allocation> {
+    const auto log_block        = load<uint32_t>(sb, 0x18);
+    const auto log_cluster      = load<uint32_t>(sb, 0x1C);
+    const auto first_data_block = load<uint32_t>(sb, 0x14);
+    const auto inodes_per_group = load<uint32_t>(sb, 0x28);
+    const auto rev_level        = load<uint32_t>(sb, 0x4C);
+    const auto compat           = load<uint32_t>(sb, 0x5C);
+    const auto incompat         = load<uint32_t>(sb, 0x60);
+    const auto ro_compat        = load<uint32_t>(sb, 0x64);
+    const auto reserved_gdt     = load<uint16_t>(sb, 0xCE);
+    const auto is_64bit         = (incompat & incompat_64bit) != 0;
+    const auto block_size       = 1024uz << log_block;
+    const auto inode_size       = rev_level == 0 ? 128uz : load<uint16_t>(sb, 0x58);
+    const auto desc_size        = is_64bit ? load<uint16_t>(sb, 0xFE) : 32uz;
+    const auto blocks_count     = load<uint32_t>(sb, 0x04) | (is_64bit ? uint64_t(load<uint32_t>(sb, 0x150)) << 32 : 0);
+    const auto cluster_ratio    = ro_compat & ro_compat_bigalloc ? 1uz << (log_cluster - log_block) : 1uz;
+    const auto blocks_per_group = ro_compat & ro_compat_bigalloc ? load<uint32_t>(sb, 0x24) * cluster_ratio : load<uint32_t>(sb, 0x20);
+    ensure(!(incompat & incompat_meta_bg), "ext4 meta_bg is not supported");
+    ensure(blocks_per_group != 0 && desc_size >= 32, "broken ext4 superblock");
+
+    const auto groups        = (blocks_count - first_data_block + blocks_per_group - 1) / blocks_per_group;
+    const auto gdt_blocks    = (groups * desc_size + block_size - 1) / block_size;
+    const auto itable_blocks = (inodes_per_group * inode_size + block_size - 1) / block_size;
+    std::println("ext4: {} blocks of {} bytes, {} groups", blocks_count, block_size, groups);
+
+    unwrap(gdt, part.read((first_data_block + 1) * block_size, groups * desc_size));
+    auto table = std::vector<Group>(groups);
+    for(auto g = 0uz; g < groups; g += 1) {
+        const auto base = g * desc_size;
+        const auto hi   = [&](const size_t offset) { return is_64bit && desc_size >= 64 ? uint64_t(load<uint32_t>(gdt, base + offset)) << 32 : 0; };
+        table[g]        = Group{
+            .block_bitmap = load<uint32_t>(gdt, base + 0x00) | hi(0x20),
+            .inode_bitmap = load<uint32_t>(gdt, base + 0x04) | hi(0x24),
+            .inode_table  = load<uint32_t>(gdt, base + 0x08) | hi(0x28),
+            .flags        = load<uint16_t>(gdt, base + 0x12),
+        };
+    }
+
+    const auto has_super = [&](const uint64_t g) -> bool {
+        if(g == 0) {
+            return true;
+        }
+        if(compat & compat_sparse_super2) {
+            return g == load<uint32_t>(sb, 0x24C) || g == load<uint32_t>(sb, 0x250);
+        }
+        if(ro_compat & ro_compat_sparse) {
+            return is_power_of(g, 3) || is_power_of(g, 5) || is_power_of(g, 7);
+        }
+        return true;
+    };
+
+    auto alloc = Allocation{block_size, std::vector<bool>(blocks_count)};
+    alloc.mark(0, first_data_block);
+
+    // read initialized bitmaps, batching the ones that are adjacent on disk (always the case with flex_bg)
+    auto initialized = std::vector<size_t>();
+    for(auto g = 0uz; g < groups; g += 1) {
+        if(table[g].flags & bg_block_uninit) {
+            // the bitmap is implicit, only the superblock backup and the gdt are in use
+            if(has_super(g)) {
+                alloc.mark(first_data_block + g * blocks_per_group, 1 + gdt_blocks + reserved_gdt);
+            }
+        } else {
+            initialized.push_back(g);
+        }
+    }
+    std::ranges::sort(initialized, {}, [&](const size_t g) { return table[g].block_bitmap; });
+    for(auto i = 0uz; i < initialized.size();) {
+        auto j = i + 1;
+        while(j < initialized.size() && j - i < 256 && table[initialized[j]].block_bitmap == table[initialized[j - 1]].block_bitmap + 1) {
+            j += 1;
+        }
+        unwrap(bitmaps, part.read(table[initialized[i]].block_bitmap * block_size, (j - i) * block_size));
+        for(auto k = i; k < j; k += 1) {
+            const auto g      = initialized[k];
+            const auto start  = first_data_block + g * blocks_per_group;
+            const auto count  = std::min(uint64_t(blocks_per_group), blocks_count - start);
+            const auto bitmap = bitmaps.data() + (k - i) * block_size;
+            for(auto c = 0uz; c * cluster_ratio < count; c += 1) {
+                if(int(bitmap[c / 8]) & (1 << (c % 8))) {
+                    alloc.mark(start + c * cluster_ratio, cluster_ratio);
+                }
+            }
+        }
+        i = j;
+    }
+
+    // group metadata may live in uninitialized groups with flex_bg
+    for(const auto& group : table) {
+        alloc.mark(group.block_bitmap, 1);
+        alloc.mark(group.inode_bitmap, 1);
+        alloc.mark(group.inode_table, itable_blocks);
+    }
+    return alloc;
+}
+} // namespace ext4
+
+namespace f2fs {
+constexpr auto magic               = 0xF2F52010u;
+constexpr auto block_size          = 4096uz;
+constexpr auto blocks_per_seg      = 512uz;
+constexpr auto sit_entry_size      = 74uz;
+constexpr auto sit_entries_per_blk = 55uz;
+constexpr auto sum_entries_bytes   = 7uz * blocks_per_seg;
+constexpr auto journal_size        = 507uz;
+constexpr auto sit_journal_entry   = 4uz + sit_entry_size;
+constexpr auto cp_compact_sum_flag = 0x4u;
+constexpr auto curseg_cold_data    = 2uz;
+constexpr auto max_active_logs     = 8uz;
+
+// marks valid blocks of segno from a f2fs_sit_entry
+auto mark_sit_entry(Allocation& alloc, const uint64_t main_blkaddr, const uint64_t segno, const std::byte* const entry) -> void {
+    const auto valid_map = entry + 2;
+    for(auto i = 0uz; i < blocks_per_seg; i += 1) {
+        if(int(valid_map[i / 8]) & (0x80 >> (i % 8))) {
+            alloc.mark(main_blkaddr + segno * blocks_per_seg + i, 1);
+        }
+    }
+}
+
+// sb is the 1024 byte superblock
+// the result is the union of both sit copies, the sit journal and the current segments of the newest checkpoint
+auto read_allocation(PartitionReader& part, const std::vector<std::byte>& sb) -> std::optional<Allocation> {
+    const auto log_blocksize      = load<uint32_t>(sb, 0x10);
+    const auto log_blocks_per_seg = load<uint32_t>(sb, 0x14);
+    const auto block_count        = load<uint64_t>(sb, 0x24);
+    const auto segment_count_sit  = load<uint32_t>(sb, 0x38);
+    const auto segment_count_main = load<uint32_t>(sb, 0x44);
+    const auto cp_blkaddr         = uint64_t(load<uint32_t>(sb, 0x4C));
+    const auto sit_blkaddr        = uint64_t(load<uint32_t>(sb, 0x50));
+    const auto main_blkaddr       = uint64_t(load<uint32_t>(sb, 0x5C));
+    ensure(1uz << log_blocksize == block_size && 1uz << log_blocks_per_seg == blocks_per_seg, "unsupported f2fs geometry");
+    std::println("f2fs: {} blocks, {} main segments", block_count, segment_count_main);
+
+    auto alloc = Allocation{block_size, std::vector<bool>(block_count)};
+    alloc.mark(0, main_blkaddr);
+
+    // sit, both copies
+    const auto sit_blocks = (segment_count_main + sit_entries_per_blk - 1) / sit_entries_per_blk;
+    const auto sit_copy   = uint64_t(segment_count_sit / 2) * blocks_per_seg;
+    for(const auto base : {sit_blkaddr, sit_blkaddr + sit_copy}) {
+        unwrap(sit, part.read(base * block_size, sit_blocks * block_size));
+        for(auto segno = 0uz; segno < segment_count_main; segno += 1) {
+            const auto offset = segno / sit_entries_per_blk * block_size + segno % sit_entries_per_blk * sit_entry_size;
+            mark_sit_entry(alloc, main_blkaddr, segno, sit.data() + offset);
+        }
+    }
+
+    // newest checkpoint pack
+    auto cp       = std::vector<std::byte>();
+    auto cp_start = uint64_t(0);
+    for(const auto start : {cp_blkaddr, cp_blkaddr + blocks_per_seg}) {
+        unwrap_mut(block, part.read(start * block_size, block_size));
+        // the pack ends with a copy of its first block, a torn pack has a different version there
+        const auto pack_blocks = load<uint32_t>(block, 0x88);
+        if(pack_blocks == 0 || pack_blocks > blocks_per_seg) {
+            continue;
+        }
+        unwrap(tail, part.read((start + pack_blocks - 1) * block_size, block_size));
+        if(load<uint64_t>(tail, 0) != load<uint64_t>(block, 0)) {
+            continue;
+        }
+        if(cp.empty() || load<uint64_t>(block, 0) > load<uint64_t>(cp, 0)) {
+            cp       = std::move(block);
+            cp_start = start;
+        }
+    }
+    ensure(!cp.empty(), "no valid f2fs checkpoint");
+    for(auto i = 0uz; i < max_active_logs; i += 1) {
+        for(const auto offset : {0x24uz, 0x54uz}) { // cur_node_segno, cur_data_segno
+            if(const auto segno = load<uint32_t>(cp, offset + i * 4); segno < segment_count_main) {
+                alloc.mark(main_blkaddr + uint64_t(segno) * blocks_per_seg, blocks_per_seg);
+            }
+        }
+    }
+
+    // sit journal
+    const auto ckpt_flags = load<uint32_t>(cp, 0x84);
+    const auto sum_start  = cp_start + load<uint32_t>(cp, 0x8C);
+    auto       journal    = std::vector<std::byte>();
+    if(ckpt_flags & cp_compact_sum_flag) {
+        // nat journal followed by sit journal
+        unwrap(sum, part.read(sum_start * block_size + journal_size, journal_size));
+        journal = sum;
+    } else {
+        unwrap(sum, part.read((sum_start + curseg_cold_data) * block_size + sum_entries_bytes, journal_size));
+        journal = sum;
+    }
+    const auto n_sits = std::min(uint64_t(load<uint16_t>(journal, 0)), (journal_size - 2) / sit_journal_entry);
+    for(auto i = 0uz; i < n_sits; i += 1) {
+        const auto entry = journal.data() + 2 + i * sit_journal_entry;
+        auto       segno = uint32_t();
+        memcpy(&segno, entry, sizeof(segno));
+        if(segno < segment_count_main) {
+            mark_sit_entry(alloc, main_blkaddr, segno, entry + 4);
+        }
+    }
+    return alloc;
+}
+} // namespace f2fs
+} // namespace
+
+auto find_allocated(Device& dev, const size_t disk, const size_t sector_begin, const size_t num_sectors) -> std::optional<std::vector<Run>> {
+    auto part = PartitionReader{&dev, disk, sector_begin, num_sectors};
+    unwrap(sb, part.read(1024, 1024));
+
+    auto alloc = std::optional<Allocation>();
+    if(load<uint16_t>(sb, 0x38) == ext4::magic) {
+        alloc = ext4::read_allocation(part, sb);
+    } else if(load<uint32_t>(sb, 0x00) == f2fs::magic) {
+        alloc = f2fs::read_allocation(part, sb);
+    } else {
+        std::println("unknown filesystem, reading everything");
+        return std::vector<Run>{{0, num_sectors}};
+    }
+    ensure(alloc, "failed to read filesystem metadata");
+
+    // fs blocks to sectors, rounding outwards, plus anything behind the end of the filesystem
+    auto       runs       = std::vector<Run>();
+    const auto fs_sectors = std::min<uint64_t>(num_sectors, (alloc->used.size() * alloc->block_size + fh::bytes_per_sector - 1) / fh::bytes_per_sector);
+    const auto push       = [&runs](const uint64_t begin, const uint64_t end) {
+        if(!runs.empty() && runs.back().sector_begin + runs.back().num_sectors >= begin) {
+            runs.back().num_sectors = std::max(runs.back().num_sectors, end - runs.back().sector_begin);
+        } else {
+            runs.push_back(Run{begin, end - begin});
+        }
+    };
+    for(auto block = 0uz; block < alloc->used.size();) {
+        if(!alloc->used[block]) {
+            block += 1;
+            continue;
+        }
+        auto end = block + 1;
+        while(end < alloc->used.size() && alloc->used[end]) {
+            end += 1;
+        }
+        const auto begin_sector = block * alloc->block_size / fh::bytes_per_sector;
+        const auto end_sector   = std::min(fs_sectors, (end * alloc->block_size + fh::bytes_per_sector - 1) / fh::bytes_per_sector);
+        push(begin_sector, end_sector);
+        block = end;
+    }
+    if(fs_sectors < num_sectors) {
+        push(fs_sectors, num_sectors);
+    }
+    return runs;
+}
+} // namespace fsalloc
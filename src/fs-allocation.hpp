@@ -0,0 +1,18 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "abstract-device.hpp"
+
+namespace fsalloc {
+// in device sectors, relative to the partition
+struct Run {
+    uint64_t sector_begin;
+    uint64_t num_sectors;
+};
+
+// reads the ext4 or f2fs metadata of the partition and returns the sector runs that hold allocated blocks
+// filesystem metadata is always included, unknown filesystems are reported as fully allocated
+auto find_allocated(Device& dev, size_t disk, size_t sector_begin, size_t num_sectors) -> std::optional<std::vector<Run>>;
+} // namespace fsalloc
@@ -0,0 +1,147 @@
+#include <cctype>
+#include <format>
+#include <fstream>
+#include <set>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "checksum.hpp"
+#include "firehose-actions.hpp"
+#include "gpt-backup.hpp"
+#include "gpt.hpp"
+#include "macros/unwrap.hpp"
+#include "util/charconv.hpp"
+#include "util/split.hpp"
+
+namespace backup {
+namespace {
+struct Extent {
+    size_t      disk;
+    uint64_t    sector_begin;
+    uint64_t    num_sectors;
+    std::string file;
+};
+
+auto sanitize(const std::string_view name) -> std::string {
+    auto r = std::string(name);
+    for(auto& c : r) {
+        if(!std::isalnum(static_cast<unsigned char>(c)) && c != '_' && c != '-' && c != '.') {
+            c = '_';
+        }
+    }
+    return r;
+}
+
+// primary gpt, partitions and backup gpt of each lun, in disk order
+// unallocated space between partitions is not part of the plan
+auto build_plan(Device& dev, const std::span<const size_t> disks) -> std::optional<std::vector<Extent>> {
+    auto plan  = std::vector<Extent>();
+    auto files = std::set<std::string>();
+
+    const auto add = [&](const size_t disk, const uint64_t begin, const uint64_t end, const std::string_view name) {
+        auto file = std::format("lun{}-{}", disk, sanitize(name));
+        for(auto i = 1; files.contains(file); i += 1) {
+            file = std::format("lun{}-{}-{}", disk, sanitize(name), i);
+        }
+        files.insert(file);
+        plan.push_back(Extent{disk, begin, end - begin, file + ".img"});
+    };
+
+    for(const auto disk : disks) {
+        unwrap(table, gpt::read_lun(dev, disk), "failed to read gpt of lun {}", disk);
+        const auto& header = table.header;
+        add(disk, 0, header.first_usable_lba, "gpt-primary");
+        auto prev_end = uint64_t(0);
+        for(const auto& part : table.partitions) {
+            ensure(part.first_lba >= prev_end, "lun {}: partition {} overlaps", disk, part.name);
+            add(disk, part.first_lba, part.last_lba + 1, part.name);
+            prev_end = part.last_lba + 1;
+        }
+        // header may be the backup one if the primary was broken
+        const auto last_lba = std::max(header.current_lba, header.backup_lba);
+        add(disk, header.last_usable_lba + 1, last_lba + 1, "gpt-backup");
+    }
+    return plan;
+}
+
+auto write_manifest(const std::string& dir, const std::vector<Extent>& plan) -> bool {
+    const auto path = dir + "/manifest.txt";
+    auto       file = std::ofstream(path + ".tmp");
+    ensure(file, "failed to create manifest");
+    file << "# disk sector_begin num_sectors file\n";
+    for(const auto& e : plan) {
+        file << std::format("{} {} {} {}\n", e.disk, e.sector_begin, e.num_sectors, e.file);
+    }
+    file.close();
+    ensure(file, "failed to write manifest");
+    ensure(rename((path + ".tmp").data(), path.data()) == 0);
+    return true;
+}
+
+auto read_checkpoint(const std::string& path) -> std::set<std::string> {
+    auto r    = std::set<std::string>();
+    auto file = std::ifstream(path);
+    for(auto line = std::string(); std::getline(file, line);) {
+        r.insert(line);
+    }
+    return r;
+}
+
+auto append_checkpoint(const std::string& path, const std::string_view file) -> bool {
+    const auto fd = open(path.data(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    ensure(fd >= 0);
+    const auto line = std::string(file) + "\n";
+    const auto ok   = write(fd, line.data(), line.size()) == ssize_t(line.size()) && fsync(fd) == 0;
+    close(fd);
+    ensure(ok, "failed to write checkpoint");
+    return true;
+}
+} // namespace
+
+auto backup_luns(Device& dev, const std::string_view args) -> bool {
+    const auto elms = split(args, " ");
+    ensure(elms.size() >= 2, "invalid number of arguments");
+    const auto dir   = std::string(elms[0]);
+    auto       disks = std::vector<size_t>();
+    for(const auto elm : std::span(elms).subspan(1)) {
+        unwrap(disk, from_chars<size_t>(elm), "invalid disk");
+        disks.push_back(disk);
+    }
+    ensure(mkdir(dir.data(), 0755) == 0 || errno == EEXIST, "failed to create {}", dir);
+
+    unwrap(plan, build_plan(dev, disks));
+    ensure(write_manifest(dir, plan));
+
+    const auto checkpoint = dir + "/checkpoint";
+    const auto finished   = read_checkpoint(checkpoint);
+    auto       total      = uint64_t(0);
+    for(const auto& e : plan) {
+        total += e.num_sectors;
+    }
+    std::println("backup plan: {} extents, {} MiB", plan.size(), total * fh::bytes_per_sector / 1024 / 1024);
+
+    for(const auto& e : plan) {
+        if(finished.contains(e.file)) {
+            std::println("{}: already done", e.file);
+            continue;
+        }
+        std::println("{}: lun {} {}+{}", e.file, e.disk, e.sector_begin, e.num_sectors);
+        const auto path = dir + "/" + e.file;
+        const auto temp = path + ".part";
+        ensure(fh::read_to_path(dev, e.disk, e.sector_begin, e.num_sectors, temp));
+        // the sidecar goes first, a finished image is never left without one
+        const auto temp_sums = checksum::sidecar_path(temp);
+        if(access(temp_sums.data(), F_OK) == 0) {
+            ensure(rename(temp_sums.data(), checksum::sidecar_path(path).data()) == 0);
+        } else {
+            unlink(checksum::sidecar_path(path).data());
+        }
+        ensure(rename(temp.data(), path.data()) == 0);
+        ensure(append_checkpoint(checkpoint, e.file));
+    }
+    std::println("backup done");
+    return true;
+}
+} // namespace backup
@@ -0,0 +1,11 @@
+#pragma once
+#include <string_view>
+
+#include "abstract-device.hpp"
+
+namespace backup {
+// "dir disk..."
+// dumps every gpt partition of the given luns into dir, one image per partition plus manifest.txt
+// finished partitions are recorded in dir/checkpoint and skipped when the backup is restarted
+auto backup_luns(Device& dev, std::string_view args) -> bool;
+} // namespace backup
@@ -0,0 +1,78 @@
+#include <algorithm>
+#include <cstring>
+
+#include "crc32.hpp"
+#include "firehose-actions.hpp"
+#include "gpt.hpp"
+#include "macros/unwrap.hpp"
+
+namespace gpt {
+namespace {
+constexpr auto signature = std::array{'E', 'F', 'I', ' ', 'P', 'A', 'R', 'T'};
+
+auto is_unused(const Entry& entry) -> bool {
+    return std::ranges::all_of(entry.type_guid, [](const uint8_t b) { return b == 0; });
+}
+
+// partition names are utf-16, non-ascii characters are replaced
+auto to_string(const std::array<char16_t, 36>& name) -> std::string {
+    auto r = std::string();
+    for(const auto c : name) {
+        if(c == 0) {
+            break;
+        }
+        r.push_back(c < 0x80 ? char(c) : '_');
+    }
+    return r;
+}
+} // namespace
+
+auto read_table(Device& dev, const size_t disk, const uint64_t lba) -> std::optional<Table> {
+    auto sector = std::vector<std::byte>(fh::bytes_per_sector);
+    ensure(fh::read_disk(dev, disk, lba, 1, sector.data()), "failed to read gpt header");
+
+    auto header = Header();
+    memcpy(&header, sector.data(), sizeof(header));
+    ensure(header.signature == signature, "no gpt signature at lba {}", lba);
+    ensure(header.header_size >= sizeof(Header) && header.header_size <= sector.size(), "invalid gpt header size");
+    ensure(header.entry_size >= sizeof(Entry), "invalid gpt entry size");
+    const auto header_crc = header.header_crc32;
+    memset(sector.data() + offsetof(Header, header_crc32), 0, sizeof(header.header_crc32));
+    ensure(crc32({sector.data(), header.header_size}) == header_crc, "gpt header crc mismatch at lba {}", lba);
+
+    const auto entries_bytes   = size_t(header.num_entries) * header.entry_size;
+    const auto entries_sectors = (entries_bytes + fh::bytes_per_sector - 1) / fh::bytes_per_sector;
+    auto       entries         = std::vector<std::byte>(entries_sectors * fh::bytes_per_sector);
+    ensure(fh::read_disk(dev, disk, header.entries_lba, entries_sectors, entries.data()), "failed to read gpt entries");
+    ensure(crc32({entries.data(), entries_bytes}) == header.entries_crc32, "gpt entries crc mismatch at lba {}", lba);
+
+    auto table   = Table();
+    table.header = header;
+    for(auto i = 0uz; i < header.num_entries; i += 1) {
+        auto entry = Entry();
+        memcpy(&entry, entries.data() + i * header.entry_size, sizeof(entry));
+        if(is_unused(entry)) {
+            continue;
+        }
+        ensure(entry.first_lba <= entry.last_lba, "invalid partition entry {}", i);
+        table.partitions.push_back(Partition{to_string(entry.name), entry.first_lba, entry.last_lba});
+    }
+    std::ranges::sort(table.partitions, {}, &Partition::first_lba);
+    return table;
+}
+
+auto read_lun(Device& dev, const size_t disk) -> std::optional<Table> {
+    if(auto primary = read_table(dev, disk, 1)) {
+        if(const auto backup = read_table(dev, disk, primary->header.backup_lba); !backup) {
+            std::println("lun {}: backup gpt is broken", disk);
+        } else if(backup->partitions.size() != primary->partitions.size()) {
+            std::println("lun {}: primary and backup gpt differ", disk);
+        }
+        return primary;
+    }
+    std::println("lun {}: primary gpt is broken, trying backup", disk);
+    const auto total = fh::assume_total_sectors(dev, disk);
+    ensure(total > 0);
+    return read_table(dev, disk, total - 1);
+}
+} // namespace gpt
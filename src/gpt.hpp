@@ -0,0 +1,52 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "abstract-device.hpp"
+
+namespace gpt {
+struct Header {
+    std::array<char, 8>     signature; // "EFI PART"
+    uint32_t                revision;
+    uint32_t                header_size;
+    uint32_t                header_crc32;
+    uint32_t                reserved;
+    uint64_t                current_lba;
+    uint64_t                backup_lba;
+    uint64_t                first_usable_lba;
+    uint64_t                last_usable_lba;
+    std::array<uint8_t, 16> disk_guid;
+    uint64_t                entries_lba;
+    uint32_t                num_entries;
+    uint32_t                entry_size;
+    uint32_t                entries_crc32;
+} __attribute__((packed));
+
+struct Entry {
+    std::array<uint8_t, 16>  type_guid;
+    std::array<uint8_t, 16>  unique_guid;
+    uint64_t                 first_lba;
+    uint64_t                 last_lba; // inclusive
+    uint64_t                 attributes;
+    std::array<char16_t, 36> name;
+} __attribute__((packed));
+
+struct Partition {
+    std::string name;
+    uint64_t    first_lba;
+    uint64_t    last_lba; // inclusive
+};
+
+struct Table {
+    Header                 header;
+    std::vector<Partition> partitions; // sorted by first_lba
+};
+
+// reads and validates the gpt header at lba and its partition entries
+auto read_table(Device& dev, size_t disk, uint64_t lba) -> std::optional<Table>;
+// reads the primary gpt, falls back to the backup one if the primary is broken
+auto read_lun(Device& dev, size_t disk) -> std::optional<Table>;
+} // namespace gpt
@@ -0,0 +1,140 @@
+#include <algorithm>
+
+#include "buffer-pool.hpp"
+#include "config.hpp"
+#include "control.hpp"
+#include "firehose-actions.hpp"
+#include "lazy-clone.hpp"
+#include "macros/unwrap.hpp"
+
+namespace lazy {
+namespace {
+constexpr auto sync_chunks = 64uz; // chunks copied between syncs of the clone
+} // namespace
+
+// the lock, once no request is waiting and none arrived for config::clone_idle_ms
+// not locked if the copier is stopping
+auto Copier::wait_idle() -> std::unique_lock<std::mutex> {
+    const auto idle = std::chrono::milliseconds(config::clone_idle_ms);
+    while(!stop) {
+        const auto quiet = Clock::now() - last_request.load();
+        if(waiting != 0) {
+            std::this_thread::sleep_for(idle);
+            continue;
+        }
+        if(quiet < idle) {
+            std::this_thread::sleep_for(idle - quiet);
+            continue;
+        }
+        auto l = std::unique_lock(lock);
+        if(waiting == 0) {
+            return l;
+        }
+    }
+    return {};
+}
+
+// copies the blocks of begin..begin+count missing from the clone
+// reads that fail are split in halves until the bad sectors are single ones, the lock is released in between
+auto Copier::copy(size_t begin, const size_t count, std::byte* const buf) -> bool {
+    const auto end = begin + count;
+    while(begin < end) {
+        auto l = wait_idle();
+        if(!l.owns_lock()) {
+            return false;
+        }
+        // requests may have written into the range while it was unlocked
+        const auto [run_begin, run_blocks] = cache.find_missing(begin, end - begin);
+        if(run_blocks == 0) {
+            return true;
+        }
+        auto run_end = run_begin + run_blocks;
+        if(const auto range = bad.find(run_begin, run_blocks); range != nullptr) {
+            if(range->begin <= run_begin) {
+                begin = std::min(range->begin + range->count, end);
+                continue;
+            }
+            run_end = range->begin;
+        }
+        const auto blocks = run_end - run_begin;
+        if(fh::read_disk(dev, disk, run_begin, blocks, buf)) {
+            ensure(cache.store(run_begin, blocks, buf));
+            control::stats.clone_blocks += blocks;
+        } else if(blocks == 1) {
+            bad.add({run_begin, 1});
+            // on demand reads of it fail at once from now on
+            ensure(fh::set_bad_map(bad));
+        } else {
+            l.unlock();
+            // a stop is not an error, it is reported once by copier_main
+            const auto half = blocks / 2;
+            if(!copy(run_begin, half, buf) || !copy(run_begin + half, blocks - half, buf)) {
+                return false;
+            }
+        }
+        begin = run_end;
+    }
+    return true;
+}
+
+auto Copier::save_progress() -> bool {
+    ensure(cache.sync());
+    ensure(bad_map_path.empty() || bad.save(bad_map_path));
+    return true;
+}
+
+auto Copier::copier_main() -> void {
+    const auto chunk = std::max(config::clone_chunk_bytes / cache.block_size, 1uz);
+    const auto buf   = pool::acquire(chunk * cache.block_size);
+    if(buf.empty()) {
+        std::println("failed to allocate clone buffer");
+        return;
+    }
+    const auto start   = Clock::now();
+    auto       percent = 0uz;
+    for(auto block = 0uz, chunks = 0uz; block < cache.block_count; chunks += 1) {
+        const auto blocks = std::min(chunk, cache.block_count - block);
+        if(!copy(block, blocks, buf.data())) {
+            if(!stop) {
+                std::println("clone stopped at block {}", block);
+            }
+            auto l = std::unique_lock(lock);
+            save_progress();
+            return;
+        }
+        block += blocks;
+        if(const auto p = block * 100 / cache.block_count; p != percent || chunks % sync_chunks == 0) {
+            auto l = std::unique_lock(lock);
+            if(!save_progress()) {
+                return;
+            }
+            if(p != percent) {
+                percent = p;
+                std::println("clone {}%, {} bad sectors", percent, bad.get_bad_sectors());
+            }
+        }
+    }
+
+    auto l = std::unique_lock(lock);
+    if(!save_progress()) {
+        return;
+    }
+    done = true;
+    const auto seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::println("clone complete in {:.1f}s, {} bad sectors in {} ranges, the device is no longer used", seconds, bad.get_bad_sectors(), bad.ranges.size());
+}
+
+auto Copier::start() -> void {
+    thread = std::thread(&Copier::copier_main, this);
+}
+
+Copier::Copier(Device& dev, const size_t disk, BlockCache& cache, scan::BadMap bad, std::string bad_map_path)
+    : dev(dev), disk(disk), cache(cache), bad(std::move(bad)), bad_map_path(std::move(bad_map_path)), last_request(Clock::now()) {}
+
+Copier::~Copier() {
+    stop = true;
+    if(thread.joinable()) {
+        thread.join();
+    }
+}
+} // namespace lazy
@@ -0,0 +1,60 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "abstract-device.hpp"
+#include "block-cache.hpp"
+#include "media-scan.hpp"
+
+// lazy clone of a lun into a BlockCache, for buse --clone
+// the lun is served at once, blocks that are not in the clone yet are read from the device on demand
+// and the rest is copied in large sequential reads whenever the nbd side is idle
+// writes only go to the clone, so the device is read from until the copy completes and never touched after that
+namespace lazy {
+class Copier {
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    Device&                        dev;
+    size_t                         disk;
+    BlockCache&                    cache;
+    scan::BadMap                   bad;          // sectors that could not be copied, never retried
+    std::string                    bad_map_path; // saved there as well if not empty
+    std::mutex                     lock;         // held by whoever uses the device or the cache
+    std::atomic<size_t>            waiting = 0;  // requests waiting for lock, the copier does not take it while any is
+    std::atomic<Clock::time_point> last_request;
+    std::atomic<bool>              done = false;
+    std::atomic<bool>              stop = false;
+    std::thread                    thread;
+
+    auto wait_idle() -> std::unique_lock<std::mutex>;
+    auto copy(size_t begin, size_t count, std::byte* buf) -> bool;
+    auto save_progress() -> bool;
+    auto copier_main() -> void;
+
+  public:
+    // runs a request with the device and the cache, ahead of the copy
+    template <class F>
+    auto run_request(F f) -> decltype(f()) {
+        waiting += 1;
+        auto l = std::unique_lock(lock);
+        waiting -= 1;
+        const auto r = f();
+        last_request = Clock::now();
+        return r;
+    }
+
+    // every block is either in the clone or bad
+    auto is_done() const -> bool {
+        return done;
+    }
+
+    auto start() -> void;
+
+    Copier(Device& dev, size_t disk, BlockCache& cache, scan::BadMap bad, std::string bad_map_path);
+    ~Copier();
+};
+} // namespace lazy
@@ -0,0 +1,215 @@
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <sstream>
+#include <utility>
+
+#include <dirent.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "loader-library.hpp"
+#include "macros/unwrap.hpp"
+#include "util/charconv.hpp"
+#include "util/fd.hpp"
+
+namespace loader {
+namespace {
+constexpr auto index_name   = ".edl-index";
+constexpr auto index_header = "edli1";
+
+auto is_hex(const std::string_view str) -> bool {
+    return !str.empty() && std::ranges::all_of(str, [](const char c) { return std::isxdigit(uint8_t(c)); });
+}
+
+// "<hwid>_<pkhash>[_anything]"
+auto parse_name(const std::string_view name, Entry& entry) -> bool {
+    const auto first  = name.find('_');
+    const auto second = name.find_first_of("_.", first + 1);
+    if(first != 16) {
+        return false;
+    }
+    const auto hwid   = name.substr(0, first);
+    const auto pkhash = name.substr(first + 1, second == name.npos ? name.npos : second - first - 1);
+    if(!is_hex(hwid) || !is_hex(pkhash)) {
+        return false;
+    }
+    const auto hwid_v = from_chars<uint64_t>(hwid, 16);
+    if(!hwid_v) {
+        return false;
+    }
+    entry.hwid = *hwid_v;
+    entry.pkhash.clear();
+    std::ranges::transform(pkhash, std::back_inserter(entry.pkhash), [](const char c) { return char(std::tolower(uint8_t(c))); });
+    return true;
+}
+
+template <class Ehdr, class Phdr>
+auto validate_elf(const std::span<const std::byte> file) -> bool {
+    auto ehdr = Ehdr();
+    ensure(file.size() >= sizeof(ehdr), "truncated elf header");
+    memcpy(&ehdr, file.data(), sizeof(ehdr));
+    ensure(ehdr.e_phnum != 0, "no program headers");
+    ensure(ehdr.e_phentsize == sizeof(Phdr), "unexpected program header size {}", ehdr.e_phentsize);
+    ensure(ehdr.e_phoff <= file.size() && ehdr.e_phnum * sizeof(Phdr) <= file.size() - ehdr.e_phoff, "program headers beyond the end of file");
+
+    auto loads = 0uz;
+    for(auto i = 0uz; i < ehdr.e_phnum; i += 1) {
+        auto phdr = Phdr();
+        memcpy(&phdr, file.data() + ehdr.e_phoff + i * sizeof(Phdr), sizeof(phdr));
+        ensure(phdr.p_offset <= file.size() && phdr.p_filesz <= file.size() - phdr.p_offset, "segment {} beyond the end of file", i);
+        loads += phdr.p_type == PT_LOAD ? 1 : 0;
+    }
+    ensure(loads != 0, "no loadable segment");
+    return true;
+}
+
+auto validate(const std::span<const std::byte> file) -> bool {
+    ensure(file.size() >= EI_NIDENT && memcmp(file.data(), ELFMAG, SELFMAG) == 0, "not an elf file");
+    ensure(uint8_t(file[EI_DATA]) == ELFDATA2LSB, "not a little endian elf");
+    switch(uint8_t(file[EI_CLASS])) {
+    case ELFCLASS32:
+        return validate_elf<Elf32_Ehdr, Elf32_Phdr>(file);
+    case ELFCLASS64:
+        return validate_elf<Elf64_Ehdr, Elf64_Phdr>(file);
+    }
+    bail("unknown elf class");
+}
+
+auto load_index(const std::string& path) -> std::vector<Entry> {
+    auto r    = std::vector<Entry>();
+    auto file = std::ifstream(path);
+    auto line = std::string();
+    if(!std::getline(file, line) || line != index_header) {
+        return r;
+    }
+    while(std::getline(file, line)) {
+        // "<valid> <size> <mtime_ns> <name>", the name goes last as it may contain spaces
+        auto stream = std::istringstream(line);
+        auto entry  = Entry();
+        if(stream >> entry.valid >> entry.size >> entry.mtime_ns && stream.get() == ' ' && std::getline(stream, entry.name)) {
+            r.push_back(std::move(entry));
+        }
+    }
+    return r;
+}
+
+// written to a private name and renamed into place, two clients may share a library
+auto save_index(const std::string& path, const std::span<const Entry> entries) -> bool {
+    const auto temp = std::format("{}.{}.tmp", path, getpid());
+    {
+        auto file = std::ofstream(temp);
+        file << index_header << '\n';
+        for(const auto& entry : entries) {
+            file << std::format("{} {} {} {}\n", int(entry.valid), entry.size, entry.mtime_ns, entry.name);
+        }
+        ensure(file.flush(), "failed to write {}", temp);
+    }
+    ensure(rename(temp.data(), path.data()) == 0, "failed to save {} errno={}({})", path, errno, strerror(errno));
+    return true;
+}
+} // namespace
+
+Image::Image(std::byte* const ptr, const size_t bytes) : ptr(ptr), bytes(bytes) {}
+
+Image::Image(Image&& o) : ptr(std::exchange(o.ptr, nullptr)), bytes(std::exchange(o.bytes, 0)) {}
+
+auto Image::operator=(Image&& o) -> Image& {
+    std::swap(ptr, o.ptr);
+    std::swap(bytes, o.bytes);
+    return *this;
+}
+
+Image::~Image() {
+    if(ptr != nullptr) {
+        munmap(ptr, bytes);
+    }
+}
+
+auto map_image(const std::string_view path) -> std::optional<Image> {
+    const auto fd = FileDescriptor(open(std::string(path).data(), O_RDONLY | O_CLOEXEC));
+    ensure(fd.as_handle() >= 0, "failed to open {} errno={}({})", path, errno, strerror(errno));
+    struct stat st;
+    ensure(fstat(fd.as_handle(), &st) == 0 && st.st_size > 0, "empty loader {}", path);
+    const auto p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd.as_handle(), 0);
+    ensure(p != MAP_FAILED, "failed to map {} errno={}({})", path, errno, strerror(errno));
+    return Image(static_cast<std::byte*>(p), st.st_size);
+}
+
+auto Library::open(const std::string_view dir_path) -> bool {
+    dir = std::string(dir_path);
+    entries.clear();
+
+    const auto index_path = std::format("{}/{}", dir, index_name);
+    const auto cached     = load_index(index_path);
+
+    const auto dirp = opendir(dir.data());
+    ensure(dirp != nullptr, "failed to open loader library {} errno={}({})", dir, errno, strerror(errno));
+    auto changed = false;
+    while(const auto dirent = readdir(dirp)) {
+        auto        entry = Entry{.name = dirent->d_name};
+        struct stat st;
+        if(entry.name.starts_with('.') || !parse_name(entry.name, entry) ||
+           fstatat(dirfd(dirp), dirent->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        entry.size     = st.st_size;
+        entry.mtime_ns = st.st_mtim.tv_sec * 1'000'000'000 + st.st_mtim.tv_nsec;
+
+        const auto hit = std::ranges::find_if(cached, [&entry](const Entry& e) {
+            return e.name == entry.name && e.size == entry.size && e.mtime_ns == entry.mtime_ns;
+        });
+        if(hit != cached.end()) {
+            entry.valid = hit->valid;
+        } else {
+            const auto image = map_image(get_path(entry));
+            entry.valid      = image && validate(image->span());
+            changed          = true;
+            if(!entry.valid) {
+                std::println("ignoring loader {}", entry.name);
+            }
+        }
+        entries.push_back(std::move(entry));
+    }
+    closedir(dirp);
+
+    std::ranges::sort(entries, {}, &Entry::name);
+    changed |= entries.size() != cached.size();
+    if(changed && !save_index(index_path, entries)) {
+        // a read-only library still works, it is just validated again next time
+        std::println("continuing without updating the loader index");
+    }
+    return true;
+}
+
+auto Library::find(const Ids& ids) const -> const Entry* {
+    constexpr auto msm_id = [](const uint64_t hwid) { return hwid >> 32; };
+
+    auto best       = (const Entry*)(nullptr);
+    auto best_score = std::pair{false, 0uz};
+    for(const auto& entry : entries) {
+        if(!entry.valid || msm_id(entry.hwid) != msm_id(ids.hwid) || !ids.pkhash.starts_with(entry.pkhash)) {
+            continue;
+        }
+        const auto score = std::pair{entry.hwid == ids.hwid, entry.pkhash.size()};
+        if(best == nullptr || score > best_score) {
+            best       = &entry;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+auto Library::get_path(const Entry& entry) const -> std::string {
+    return std::format("{}/{}", dir, entry.name);
+}
+
+auto Library::get_entries() const -> std::span<const Entry> {
+    return entries;
+}
+} // namespace loader
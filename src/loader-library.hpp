@@ -0,0 +1,68 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// a directory of programmers, selected by the ids sahara reports
+// loaders are named "<hwid>_<pkhash>[_anything]" like the Loaders directory of bkerler's edl,
+// hwid is the 16 hex digit msm hw id and pkhash is a hex prefix of the oem public key hash
+// elf headers are validated once, the results are cached in "<dir>/.edl-index" keyed by file size and mtime
+namespace loader {
+struct Ids {
+    uint64_t    hwid;   // msm id << 32 | oem id << 16 | model id
+    std::string pkhash; // lowercase hex
+};
+
+struct Entry {
+    std::string name;
+    uint64_t    size;
+    int64_t     mtime_ns;
+    uint64_t    hwid;
+    std::string pkhash; // lowercase hex prefix, from the name
+    bool        valid;  // passed elf validation
+};
+
+// read-only mapping of a loader, uploads are served from it without copying
+class Image {
+  private:
+    std::byte* ptr   = nullptr;
+    size_t     bytes = 0;
+
+  public:
+    auto data() const -> const std::byte* {
+        return ptr;
+    }
+
+    auto size() const -> size_t {
+        return bytes;
+    }
+
+    auto span() const -> std::span<const std::byte> {
+        return {ptr, bytes};
+    }
+
+    Image() = default;
+    Image(std::byte* ptr, size_t bytes);
+    Image(Image&& o);
+    auto operator=(Image&& o) -> Image&;
+    ~Image();
+};
+
+auto map_image(std::string_view path) -> std::optional<Image>;
+
+class Library {
+  private:
+    std::string        dir;
+    std::vector<Entry> entries;
+
+  public:
+    auto open(std::string_view dir) -> bool;
+    // exact hwid before a loader for the same msm id, then the longest pkhash prefix
+    auto find(const Ids& ids) const -> const Entry*;
+    auto get_path(const Entry& entry) const -> std::string;
+    auto get_entries() const -> std::span<const Entry>;
+};
+} // namespace loader
@@ -0,0 +1,141 @@
+#include <algorithm>
+#include <chrono>
+#include <format>
+#include <fstream>
+
+#include "buffer-pool.hpp"
+#include "config.hpp"
+#include "firehose-actions.hpp"
+#include "macros/unwrap.hpp"
+#include "media-scan.hpp"
+#include "util/charconv.hpp"
+#include "util/split.hpp"
+
+namespace scan {
+namespace {
+constexpr auto map_header = std::string_view("edlbad1");
+
+struct Scanner {
+    Device&      dev;
+    size_t       disk;
+    pool::Buffer buf;
+    BadMap       map;
+    size_t       failed_reads = 0;
+
+    // reads that fail are split in halves until the bad sectors are single ones
+    auto bisect(const size_t begin, const size_t count) -> void {
+        if(fh::read_disk(dev, disk, begin, count, buf.data())) {
+            return;
+        }
+        failed_reads += 1;
+        if(count == 1) {
+            map.add({begin, 1});
+            return;
+        }
+        const auto half = count / 2;
+        bisect(begin, half);
+        bisect(begin + half, count - half);
+    }
+};
+} // namespace
+
+auto BadMap::add(const Range range) -> void {
+    auto begin = range.begin;
+    auto end   = range.begin + range.count;
+    // absorb every range that overlaps or touches the new one
+    const auto first = std::ranges::lower_bound(ranges, begin, {}, [](const Range& r) { return r.begin + r.count; });
+    auto       last  = first;
+    for(; last != ranges.end() && last->begin <= end; ++last) {
+        begin = std::min(begin, last->begin);
+        end   = std::max(end, last->begin + last->count);
+    }
+    const auto pos = ranges.erase(first, last);
+    ranges.insert(pos, Range{begin, end - begin});
+}
+
+auto BadMap::find(const size_t begin, const size_t count) const -> const Range* {
+    const auto it = std::ranges::upper_bound(ranges, begin, {}, [](const Range& r) { return r.begin + r.count; });
+    return it != ranges.end() && it->begin < begin + count ? &*it : nullptr;
+}
+
+auto BadMap::get_bad_sectors() const -> size_t {
+    auto r = 0uz;
+    for(const auto& range : ranges) {
+        r += range.count;
+    }
+    return r;
+}
+
+auto BadMap::load(const std::string_view path) -> bool {
+    auto file = std::ifstream(std::string(path));
+    ensure(file, "failed to open {}", path);
+    auto line = std::string();
+    ensure(std::getline(file, line), "empty bad range map");
+    const auto elms = split(line, " ");
+    ensure(elms.size() == 5 && elms[0] == map_header, "not a bad range map");
+    unwrap(disk_v, from_chars<size_t>(elms[1]), "invalid disk");
+    unwrap(sector_bytes_v, from_chars<size_t>(elms[2]), "invalid sector size");
+    unwrap(sector_begin_v, from_chars<size_t>(elms[3]), "invalid sector begin");
+    unwrap(num_sectors_v, from_chars<size_t>(elms[4]), "invalid num sectors");
+    disk         = disk_v;
+    sector_bytes = sector_bytes_v;
+    sector_begin = sector_begin_v;
+    num_sectors  = num_sectors_v;
+
+    ranges.clear();
+    while(std::getline(file, line)) {
+        const auto range = split(line, " ");
+        ensure(range.size() == 2, "malformed bad range {}", line);
+        unwrap(begin, from_chars<size_t>(range[0]), "malformed bad range {}", line);
+        unwrap(count, from_chars<size_t>(range[1]), "malformed bad range {}", line);
+        add({begin, count});
+    }
+    return true;
+}
+
+auto BadMap::save(const std::string_view path) const -> bool {
+    auto file = std::ofstream(std::string(path));
+    file << std::format("{} {} {} {} {}\n", map_header, disk, sector_bytes, sector_begin, num_sectors);
+    for(const auto& range : ranges) {
+        file << std::format("{} {}\n", range.begin, range.count);
+    }
+    ensure(file.flush(), "failed to write {}", path);
+    return true;
+}
+
+auto scan_disk(Device& dev, const size_t disk, const size_t sector_begin, const size_t num_sectors) -> std::optional<BadMap> {
+    const auto chunk_sectors = std::max(config::scan_chunk_bytes / fh::bytes_per_sector, 1uz);
+    auto       scanner       = Scanner{dev, disk, pool::acquire(chunk_sectors * fh::bytes_per_sector), BadMap{disk, fh::bytes_per_sector, sector_begin, num_sectors, {}}};
+    ensure(!scanner.buf.empty(), "failed to allocate buffer");
+    // an old map would fail the reads of its ranges without asking the device
+    fh::clear_bad_map(disk);
+
+    const auto quiet   = fh::VerbosityScope(dev, false);
+    const auto start   = std::chrono::steady_clock::now();
+    auto       percent = 0uz;
+    for(auto sector = 0uz; sector < num_sectors;) {
+        const auto sectors = std::min(chunk_sectors, num_sectors - sector);
+        scanner.bisect(sector_begin + sector, sectors);
+        sector += sectors;
+        if(const auto p = sector * 100 / num_sectors; p != percent) {
+            percent = p;
+            std::println("{}%, {} bad sectors", percent, scanner.map.get_bad_sectors());
+        }
+    }
+
+    const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::println("scanned {} sectors in {:.1f}s ({:.1f} MiB/s), {} bad sectors in {} ranges, {} failed reads",
+                 num_sectors, seconds, num_sectors * fh::bytes_per_sector / seconds / 1024 / 1024,
+                 scanner.map.get_bad_sectors(), scanner.map.ranges.size(), scanner.failed_reads);
+    return std::move(scanner.map);
+}
+
+auto scan_to_file(Device& dev, const std::string_view args_str) -> bool {
+    auto args = fh::RWArgs();
+    ensure(fh::parse_rw_args(args_str, args));
+    unwrap_mut(map, scan_disk(dev, args.disk, args.sector_begin, args.num_sectors));
+    ensure(map.save(args.file));
+    ensure(fh::set_bad_map(std::move(map)));
+    return true;
+}
+} // namespace scan
@@ -0,0 +1,36 @@
+#pragma once
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "abstract-device.hpp"
+
+// readability scan of a lun and the resulting bad range map
+// chunks are read at full speed, only a chunk that fails is bisected down to its bad sectors
+// map file: "edlbad1 disk sector_bytes sector_begin num_sectors" followed by one "begin count" line per bad range
+namespace scan {
+struct Range {
+    size_t begin; // in sectors
+    size_t count;
+};
+
+// unreadable ranges of one lun, sorted and merged
+struct BadMap {
+    size_t             disk;
+    size_t             sector_bytes;
+    size_t             sector_begin; // the scanned range
+    size_t             num_sectors;
+    std::vector<Range> ranges;
+
+    auto add(Range range) -> void;
+    // the first bad range overlapping the given sectors
+    auto find(size_t begin, size_t count) const -> const Range*;
+    auto get_bad_sectors() const -> size_t;
+    auto load(std::string_view path) -> bool;
+    auto save(std::string_view path) const -> bool;
+};
+
+auto scan_disk(Device& dev, size_t disk, size_t sector_begin, size_t num_sectors) -> std::optional<BadMap>;
+// "disk sector_begin num_sectors map", the map is also used by the rest of the session, see fh::set_bad_map
+auto scan_to_file(Device& dev, std::string_view args) -> bool;
+} // namespace scan
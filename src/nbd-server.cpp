@@ -0,0 +1,537 @@
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "buffer-pool.hpp"
+#include "config.hpp"
+#include "control.hpp"
+#include "macros/unwrap.hpp"
+#include "nbd-server.hpp"
+#include "util/fd.hpp"
+
+namespace nbd {
+namespace {
+constexpr auto nbd_magic          = 0x4e42444d41474943ull; // "NBDMAGIC"
+constexpr auto option_magic       = 0x49484156454f5054ull; // "IHAVEOPT"
+constexpr auto option_reply_magic = 0x0003e889045565a9ull;
+constexpr auto request_magic      = 0x25609513u;
+constexpr auto simple_reply_magic = 0x67446698u;
+constexpr auto chunk_reply_magic  = 0x668e33efu;
+constexpr auto max_request_bytes  = 32u * 1024 * 1024;
+
+enum HandshakeFlags : uint16_t {
+    FixedNewstyle = 1 << 0,
+    NoZeroes      = 1 << 1,
+};
+
+enum TransmissionFlags : uint16_t {
+    HasFlags  = 1 << 0,
+    ReadOnly  = 1 << 1,
+    SendFlush = 1 << 2,
+    SendTrim  = 1 << 5,
+};
+
+enum Option : uint32_t {
+    ExportName      = 1,
+    Abort           = 2,
+    List            = 3,
+    Info            = 6,
+    Go              = 7,
+    StructuredReply = 8,
+};
+
+enum OptionReply : uint32_t {
+    Ack        = 1,
+    Server     = 2,
+    InfoReply  = 3,
+    ErrUnsup   = (1u << 31) + 1,
+    ErrInvalid = (1u << 31) + 3,
+};
+
+enum InfoType : uint16_t {
+    InfoExport    = 0,
+    InfoBlockSize = 3,
+};
+
+enum Command : uint16_t {
+    Read  = 0,
+    Write = 1,
+    Disc  = 2,
+    Flush = 3,
+    Trim  = 4,
+};
+
+enum ChunkType : uint16_t {
+    ChunkNone       = 0,
+    ChunkOffsetData = 1,
+    ChunkError      = (1 << 15) + 1,
+};
+
+constexpr auto chunk_flag_done = uint16_t(1);
+
+struct OptionHeader {
+    uint64_t magic;
+    uint32_t option;
+    uint32_t length;
+} __attribute__((packed));
+
+struct OptionReplyHeader {
+    uint64_t magic;
+    uint32_t option;
+    uint32_t type;
+    uint32_t length;
+} __attribute__((packed));
+
+struct RequestHeader {
+    uint32_t magic;
+    uint16_t flags;
+    uint16_t type;
+    uint64_t handle;
+    uint64_t offset;
+    uint32_t length;
+} __attribute__((packed));
+
+struct SimpleReply {
+    uint32_t magic;
+    uint32_t error;
+    uint64_t handle;
+} __attribute__((packed));
+
+struct ChunkHeader {
+    uint32_t magic;
+    uint16_t flags;
+    uint16_t type;
+    uint64_t handle;
+    uint32_t length;
+} __attribute__((packed));
+
+template <class T>
+auto be(const T value) -> T {
+    if constexpr(std::endian::native == std::endian::big) {
+        return value;
+    } else {
+        return std::byteswap(value);
+    }
+}
+
+// appends big endian integers
+struct Buffer {
+    std::vector<std::byte> data;
+
+    template <class T>
+    auto put(const T value) -> Buffer& {
+        const auto v = be(value);
+        const auto p = std::bit_cast<std::array<std::byte, sizeof(T)>>(v);
+        data.insert(data.end(), p.begin(), p.end());
+        return *this;
+    }
+};
+
+auto send_option_reply(FileDescriptor& fd, const uint32_t option, const uint32_t type, const std::span<const std::byte> payload = {}) -> bool {
+    const auto header = OptionReplyHeader{be(option_reply_magic), be(option), be(type), be(uint32_t(payload.size()))};
+    ensure(fd.write(&header, sizeof(header)));
+    ensure(payload.empty() || fd.write(payload.data(), payload.size()));
+    return true;
+}
+
+struct Session {
+    bool structured = false;
+};
+
+// returns nullopt if the client went away before entering transmission
+auto negotiate(FileDescriptor& fd, buse::BlockOperator& op) -> std::optional<Session> {
+    auto       session = Session();
+    const auto size    = uint64_t(op.block_size * op.block_count);
+    const auto flags   = uint16_t(HasFlags | SendFlush | SendTrim | (config::disk_read_only ? ReadOnly : 0));
+
+    const auto greeting = Buffer().put(nbd_magic).put(option_magic).put(uint16_t(FixedNewstyle | NoZeroes)).data;
+    ensure(fd.write(greeting.data(), greeting.size()));
+    auto client_flags = uint32_t();
+    ensure(fd.read(&client_flags, sizeof(client_flags)));
+    ensure(be(client_flags) & FixedNewstyle, "client does not support fixed newstyle");
+    const auto no_zeroes = (be(client_flags) & NoZeroes) != 0;
+
+    while(true) {
+        auto header = OptionHeader();
+        ensure(fd.read(&header, sizeof(header)));
+        ensure(be(header.magic) == option_magic, "bad option magic");
+        const auto option = be(header.option);
+        const auto length = be(header.length);
+        ensure(length <= 4096, "option too large");
+        auto data = std::vector<std::byte>(length);
+        ensure(length == 0 || fd.read(data.data(), length));
+
+        switch(option) {
+        case ExportName: {
+            auto reply = Buffer().put(size).put(flags).data;
+            if(!no_zeroes) {
+                reply.resize(reply.size() + 124);
+            }
+            ensure(fd.write(reply.data(), reply.size()));
+            return session;
+        }
+        case Abort:
+            send_option_reply(fd, option, Ack);
+            return std::nullopt;
+        case List: {
+            // the lun is the only export, under the empty name
+            const auto name = Buffer().put(uint32_t(0)).data;
+            ensure(send_option_reply(fd, option, Server, name));
+            ensure(send_option_reply(fd, option, Ack));
+        } break;
+        case StructuredReply:
+            if(length != 0) {
+                ensure(send_option_reply(fd, option, ErrInvalid));
+                break;
+            }
+            session.structured = true;
+            ensure(send_option_reply(fd, option, Ack));
+            break;
+        case Info:
+        case Go: {
+            // any export name is accepted, the requested info list is ignored since both replies are always sent
+            if(length < 6) {
+                ensure(send_option_reply(fd, option, ErrInvalid));
+                break;
+            }
+            const auto export_info = Buffer().put(uint16_t(InfoExport)).put(size).put(flags).data;
+            const auto block_info  = Buffer().put(uint16_t(InfoBlockSize)).put(uint32_t(1)).put(uint32_t(op.block_size)).put(max_request_bytes).data;
+            ensure(send_option_reply(fd, option, InfoReply, export_info));
+            ensure(send_option_reply(fd, option, InfoReply, block_info));
+            ensure(send_option_reply(fd, option, Ack));
+            if(option == Go) {
+                return session;
+            }
+        } break;
+        default:
+            ensure(send_option_reply(fd, option, ErrUnsup));
+            break;
+        }
+    }
+}
+
+struct Request {
+    uint16_t               type;
+    uint64_t               handle;
+    uint64_t               offset;
+    uint32_t     length;
+    pool::Buffer data; // payload of writes
+};
+
+class Connection {
+  private:
+    FileDescriptor&      fd;
+    buse::BlockOperator& op;
+    Session              session;
+
+    std::mutex              lock;
+    std::condition_variable cond;
+    std::deque<Request>     queue;
+    bool                    closed = false;
+
+    auto receiver_main() -> void;
+    auto reply(const Request& request, uint32_t error, std::span<const std::byte> data = {}) -> bool;
+    auto check(const Request& request) -> uint32_t;
+    auto run_merged(std::span<Request*> requests) -> bool;
+    auto run_one(Request& request) -> bool;
+    auto run_batch(std::vector<Request>& batch) -> bool;
+
+  public:
+    auto run() -> void;
+
+    Connection(FileDescriptor& fd, buse::BlockOperator& op, const Session session) : fd(fd), op(op), session(session) {}
+};
+
+auto Connection::receiver_main() -> void {
+    while(true) {
+        auto header = RequestHeader();
+        if(!fd.read(&header, sizeof(header)) || be(header.magic) != request_magic) {
+            break;
+        }
+        auto request = Request{be(header.type), header.handle, be(header.offset), be(header.length), {}};
+        if(request.type == Write && request.length > max_request_bytes) {
+            // the payload is discarded so that the stream stays in sync, check() rejects the request
+            const auto scratch = pool::acquire(max_request_bytes);
+            if(scratch.empty()) {
+                break;
+            }
+            auto left = size_t(request.length);
+            while(left > 0 && fd.read(scratch.data(), std::min(left, scratch.size()))) {
+                left -= std::min(left, scratch.size());
+            }
+            if(left > 0) {
+                break;
+            }
+        } else if(request.type == Write) {
+            request.data = pool::acquire(request.length);
+            if(request.data.empty() || !fd.read(request.data.data(), request.length)) {
+                break;
+            }
+        }
+        const auto disconnect = request.type == Disc;
+
+        if(!disconnect) {
+            control::stats.queue_depth += 1;
+        }
+        auto l = std::unique_lock(lock);
+        queue.push_back(std::move(request));
+        cond.notify_all();
+        if(disconnect) {
+            break;
+        }
+    }
+    auto l = std::unique_lock(lock);
+    closed = true;
+    cond.notify_all();
+}
+
+// handles are echoed back as received, so they are not byte swapped
+auto Connection::reply(const Request& request, const uint32_t error, const std::span<const std::byte> data) -> bool {
+    control::stats.queue_depth -= 1;
+    if(!session.structured) {
+        const auto header = SimpleReply{be(simple_reply_magic), be(error), request.handle};
+        ensure(fd.write(&header, sizeof(header)));
+        ensure(error != 0 || data.empty() || fd.write(data.data(), data.size()));
+        return true;
+    }
+    if(error != 0) {
+        const auto payload = Buffer().put(error).put(uint16_t(0)).data;
+        const auto header  = ChunkHeader{be(chunk_reply_magic), be(chunk_flag_done), be(uint16_t(ChunkError)), request.handle, be(uint32_t(payload.size()))};
+        ensure(fd.write(&header, sizeof(header)));
+        ensure(fd.write(payload.data(), payload.size()));
+        return true;
+    }
+    if(request.type != Read) {
+        const auto header = ChunkHeader{be(chunk_reply_magic), be(chunk_flag_done), be(uint16_t(ChunkNone)), request.handle, 0};
+        ensure(fd.write(&header, sizeof(header)));
+        return true;
+    }
+    const auto header = ChunkHeader{be(chunk_reply_magic), be(chunk_flag_done), be(uint16_t(ChunkOffsetData)), request.handle, be(uint32_t(sizeof(uint64_t) + data.size()))};
+    const auto offset = be(request.offset);
+    ensure(fd.write(&header, sizeof(header)));
+    ensure(fd.write(&offset, sizeof(offset)));
+    ensure(fd.write(data.data(), data.size()));
+    return true;
+}
+
+// returns an errno value for requests that cannot be executed
+auto Connection::check(const Request& request) -> uint32_t {
+    const auto size = op.block_size * op.block_count;
+    switch(request.type) {
+    case Read:
+    case Write:
+    case Trim:
+        if(request.length > max_request_bytes) {
+            // NBD_EOVERFLOW may only be sent once structured replies are negotiated
+            return session.structured ? EOVERFLOW : EINVAL;
+        }
+        if(request.offset > size || request.length > size - request.offset) {
+            return EINVAL;
+        }
+        if(request.type != Read && config::disk_read_only) {
+            return EPERM;
+        }
+        return 0;
+    case Flush:
+    case Disc:
+        return 0;
+    default:
+        return EINVAL;
+    }
+}
+
+// requests are contiguous, block aligned and of the same type
+auto Connection::run_merged(const std::span<Request*> requests) -> bool {
+    const auto front  = requests.front();
+    const auto bytes  = requests.back()->offset + requests.back()->length - front->offset;
+    const auto block  = front->offset / op.block_size;
+    const auto blocks = bytes / op.block_size;
+    if(front->type == Write && requests.size() == 1) {
+        // nothing to merge, written from the receive buffer
+        return reply(*front, op.write_block(block, blocks, front->data.data()) ? 0u : uint32_t(EIO));
+    }
+    const auto buf = pool::acquire(bytes);
+    ensure(!buf.empty(), "failed to allocate buffer");
+    if(front->type == Read) {
+        const auto error = op.read_block(block, blocks, buf.data()) ? 0u : uint32_t(EIO);
+        for(const auto request : requests) {
+            ensure(reply(*request, error, buf.span().subspan(request->offset - front->offset, request->length)));
+        }
+    } else {
+        for(const auto request : requests) {
+            memcpy(buf.data() + (request->offset - front->offset), request->data.data(), request->length);
+        }
+        const auto error = op.write_block(block, blocks, buf.data()) ? 0u : uint32_t(EIO);
+        for(const auto request : requests) {
+            ensure(reply(*request, error));
+        }
+    }
+    return true;
+}
+
+auto Connection::run_one(Request& request) -> bool {
+    if(const auto error = check(request); error != 0) {
+        return reply(request, error);
+    }
+    switch(request.type) {
+    case Read: {
+        // unaligned, BlockOperator does the read-modify-write
+        const auto buf = pool::acquire(request.length);
+        ensure(!buf.empty(), "failed to allocate buffer");
+        return reply(request, op.read(buf.data(), buf.size(), request.offset) == 0 ? 0 : EIO, buf.span());
+    }
+    case Write:
+        return reply(request, op.write(request.data.data(), request.data.size(), request.offset) == 0 ? 0 : EIO);
+    case Trim:
+        return reply(request, op.trim(request.offset, request.length));
+    case Flush:
+        return reply(request, op.flush());
+    }
+    return true;
+}
+
+auto Connection::run_batch(std::vector<Request>& batch) -> bool {
+    const auto aligned = [this](const Request& r) {
+        return (r.type == Read || r.type == Write) && check(r) == 0 && r.length != 0 &&
+               r.offset % op.block_size == 0 && r.length % op.block_size == 0;
+    };
+
+    // flushes are barriers, requests between them may complete in any order
+    for(auto begin = batch.begin(); begin != batch.end();) {
+        const auto end = std::find_if(begin, batch.end(), [](const Request& r) { return r.type == Flush || r.type == Disc; });
+
+        auto sorted = std::vector<Request*>();
+        for(auto it = begin; it != end; it += 1) {
+            sorted.push_back(&*it);
+        }
+        std::ranges::stable_sort(sorted, {}, [](const Request* r) { return r->offset; });
+        for(auto i = 0uz; i < sorted.size();) {
+            if(!aligned(*sorted[i])) {
+                ensure(run_one(*sorted[i]));
+                i += 1;
+                continue;
+            }
+            auto j     = i + 1;
+            auto bytes = size_t(sorted[i]->length);
+            while(j < sorted.size() && aligned(*sorted[j]) && sorted[j]->type == sorted[i]->type &&
+                  sorted[j]->offset == sorted[j - 1]->offset + sorted[j - 1]->length &&
+                  bytes + sorted[j]->length <= config::nbd_merge_bytes) {
+                bytes += sorted[j]->length;
+                j += 1;
+            }
+            ensure(run_merged(std::span(sorted).subspan(i, j - i)));
+            i = j;
+        }
+
+        if(end == batch.end()) {
+            break;
+        }
+        if(end->type == Disc) {
+            op.disconnect();
+            return false;
+        }
+        ensure(run_one(*end));
+        begin = end + 1;
+    }
+    return true;
+}
+
+auto Connection::run() -> void {
+    auto receiver = std::thread(&Connection::receiver_main, this);
+    while(true) {
+        auto batch = std::vector<Request>();
+        {
+            auto l = std::unique_lock(lock);
+            cond.wait(l, [this] { return !queue.empty() || closed; });
+            if(queue.empty()) {
+                break;
+            }
+            std::ranges::move(queue, std::back_inserter(batch));
+            queue.clear();
+        }
+        if(!run_batch(batch)) {
+            break;
+        }
+    }
+    // unblock the receiver if the reply side failed first
+    shutdown(fd.as_handle(), SHUT_RDWR);
+    receiver.join();
+    op.flush();
+}
+
+auto listen_on(const std::string_view address) -> std::optional<FileDescriptor> {
+    if(address.starts_with("unix:")) {
+        const auto path = std::string(address.substr(5));
+        auto       addr = sockaddr_un{.sun_family = AF_UNIX};
+        ensure(path.size() < sizeof(addr.sun_path), "socket path too long");
+        std::ranges::copy(path, addr.sun_path);
+        unlink(path.data());
+        auto fd = FileDescriptor(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+        ensure(fd.as_handle() >= 0);
+        ensure(bind(fd.as_handle(), std::bit_cast<sockaddr*>(&addr), sizeof(addr)) == 0, "failed to bind {} errno={}({})", path, errno, strerror(errno));
+        ensure(listen(fd.as_handle(), 1) == 0);
+        return fd;
+    }
+
+    const auto colon = address.rfind(':');
+    ensure(colon != address.npos, "invalid address {}", address);
+    const auto host  = std::string(address.substr(0, colon));
+    const auto port  = std::string(address.substr(colon + 1));
+    auto       hints = addrinfo{.ai_flags = AI_PASSIVE, .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    auto       info  = (addrinfo*)(nullptr);
+    ensure(getaddrinfo(host.empty() ? nullptr : host.data(), port.data(), &hints, &info) == 0, "failed to resolve {}", address);
+    for(auto ai = info; ai != nullptr; ai = ai->ai_next) {
+        auto fd = FileDescriptor(socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol));
+        if(fd.as_handle() < 0) {
+            continue;
+        }
+        const auto one = 1;
+        setsockopt(fd.as_handle(), SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if(bind(fd.as_handle(), ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd.as_handle(), 1) == 0) {
+            freeaddrinfo(info);
+            return fd;
+        }
+    }
+    freeaddrinfo(info);
+    bail("failed to listen on {} errno={}({})", address, errno, strerror(errno));
+}
+} // namespace
+
+auto serve(buse::BlockOperator& op, const std::string_view address) -> bool {
+    unwrap_mut(listener, listen_on(address));
+    std::println("listening on {}", address);
+    while(true) {
+        auto fd = FileDescriptor(accept4(listener.as_handle(), nullptr, nullptr, SOCK_CLOEXEC));
+        if(fd.as_handle() < 0) {
+            ensure(errno == EINTR || errno == ECONNABORTED, "accept failed errno={}({})", errno, strerror(errno));
+            continue;
+        }
+        const auto one = 1;
+        setsockopt(fd.as_handle(), IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        const auto session = negotiate(fd, op);
+        if(!session) {
+            continue;
+        }
+        std::println("client connected, structured replies {}", session->structured ? "on" : "off");
+        Connection(fd, op, *session).run();
+        std::println("client disconnected");
+    }
+}
+} // namespace nbd
@@ -0,0 +1,13 @@
+#pragma once
+#include <string_view>
+
+#include "buse/block-operator.hpp"
+
+// userspace nbd server, an alternative to the kernel nbd client driven by buse::run
+// speaks the fixed newstyle handshake with structured replies and block size hints
+// requests arriving together are sorted by offset and adjacent ones merged into single device transfers,
+// so replies complete out of order
+namespace nbd {
+// address is "unix:PATH" or "[HOST]:PORT", serves one client at a time until the process is killed
+auto serve(buse::BlockOperator& op, std::string_view address) -> bool;
+} // namespace nbd
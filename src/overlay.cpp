@@ -0,0 +1,153 @@
+#include <array>
+#include <cstring>
+#include <format>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "config.hpp"
+#include "macros/assert.hpp"
+#include "overlay.hpp"
+
+namespace {
+constexpr auto magic = std::array{'E', 'D', 'L', 'O', 'V', '0', '0', '1'};
+
+struct MapHeader {
+    std::array<char, 8> magic;
+    uint64_t            block_size;
+    uint64_t            extent_count;
+};
+
+struct Extent {
+    uint64_t begin;
+    uint64_t end;
+};
+} // namespace
+
+auto Overlay::open(const std::string_view dir, const std::string_view serial, const int disk, const size_t block_size) -> bool {
+    const auto base = std::format("{}/{}-{}", dir, serial, disk);
+    data_fd         = FileDescriptor(::open((base + ".delta").data(), O_RDWR | O_CREAT, 0644));
+    ensure(data_fd.as_handle() >= 0, "failed to open overlay data errno={}({})", errno, strerror(errno));
+    map_fd = FileDescriptor(::open((base + ".extents").data(), O_RDWR | O_CREAT, 0644));
+    ensure(map_fd.as_handle() >= 0, "failed to open overlay map errno={}({})", errno, strerror(errno));
+
+    this->block_size = block_size;
+
+    auto header = MapHeader();
+    if(pread(map_fd.as_handle(), &header, sizeof(header), 0) != sizeof(header) || header.magic != magic) {
+        std::println("overlay {} is empty", base);
+        return true;
+    }
+    ensure(header.block_size == block_size, "overlay block size mismatch");
+    auto loaded = std::vector<Extent>(header.extent_count);
+    const auto len = loaded.size() * sizeof(Extent);
+    ensure(pread(map_fd.as_handle(), loaded.data(), len, sizeof(header)) == ssize_t(len), "overlay map truncated");
+    for(const auto& e : loaded) {
+        extents[e.begin] = e.end;
+    }
+    std::println("overlay {} loaded, {} dirty blocks in {} extents", base, get_dirty_blocks(), extents.size());
+    return true;
+}
+
+auto Overlay::read(size_t block, size_t blocks, std::byte* buf, const Transfer& read_base) -> bool {
+    const auto end = block + blocks;
+    // first extent that may overlap
+    auto it = extents.upper_bound(block);
+    if(it != extents.begin() && std::prev(it)->second > block) {
+        it = std::prev(it);
+    }
+    while(block < end) {
+        if(it == extents.end() || it->first >= end) {
+            return read_base(block, end - block, buf);
+        }
+        if(it->first > block) {
+            const auto len = it->first - block;
+            ensure(read_base(block, len, buf));
+            block += len;
+            buf += len * block_size;
+        }
+        const auto len   = std::min(it->second, end) - block;
+        const auto bytes = len * block_size;
+        ensure(pread(data_fd.as_handle(), buf, bytes, block * block_size) == ssize_t(bytes), "overlay read failed");
+        block += len;
+        buf += bytes;
+        it = std::next(it);
+    }
+    return true;
+}
+
+auto Overlay::write(const size_t block, const size_t blocks, const std::byte* const buf) -> bool {
+    const auto len = blocks * block_size;
+    ensure(pwrite(data_fd.as_handle(), buf, len, block * block_size) == ssize_t(len), "overlay write failed");
+
+    // merge with every extent overlapping or touching [block, block + blocks)
+    auto begin = block;
+    auto end   = block + blocks;
+    auto it    = extents.upper_bound(begin);
+    if(it != extents.begin() && std::prev(it)->second >= begin) {
+        it = std::prev(it);
+    }
+    while(it != extents.end() && it->first <= end) {
+        begin = std::min(begin, it->first);
+        end   = std::max(end, it->second);
+        it    = extents.erase(it);
+    }
+    extents[begin] = end;
+    dirty          = true;
+    return true;
+}
+
+auto Overlay::sync() -> bool {
+    if(!dirty) {
+        return true;
+    }
+    // the data file is written before the map, so a crash can only lose extents
+    ensure(fdatasync(data_fd.as_handle()) == 0);
+    auto saved = std::vector<Extent>();
+    saved.reserve(extents.size());
+    for(const auto& [begin, end] : extents) {
+        saved.push_back(Extent{begin, end});
+    }
+    const auto header = MapHeader{magic, block_size, saved.size()};
+    const auto len    = saved.size() * sizeof(Extent);
+    ensure(pwrite(map_fd.as_handle(), &header, sizeof(header), 0) == sizeof(header));
+    ensure(pwrite(map_fd.as_handle(), saved.data(), len, sizeof(header)) == ssize_t(len));
+    ensure(ftruncate(map_fd.as_handle(), sizeof(header) + len) == 0);
+    dirty = false;
+    return true;
+}
+
+auto Overlay::commit(const Transfer& write_base) -> bool {
+    ensure(sync());
+    const auto blocks_per_run = std::max(1uz, config::file_buffer_bytes / block_size);
+    auto       buf            = std::vector<std::byte>(blocks_per_run * block_size);
+    auto       committed      = 0uz;
+    // extents are sorted, so the device sees one ascending pass
+    while(!extents.empty()) {
+        const auto [begin, end] = *extents.begin();
+        for(auto block = begin; block < end;) {
+            const auto blocks = std::min(blocks_per_run, end - block);
+            const auto bytes  = blocks * block_size;
+            ensure(pread(data_fd.as_handle(), buf.data(), bytes, block * block_size) == ssize_t(bytes), "overlay read failed");
+            ensure(write_base(block, blocks, buf.data()));
+            block += blocks;
+            committed += blocks;
+        }
+        // committed extents are dropped one by one, so an interrupted commit can be resumed
+        extents.erase(extents.begin());
+        dirty = true;
+        ensure(sync());
+    }
+    ensure(ftruncate(data_fd.as_handle(), 0) == 0);
+    std::println("committed {} blocks", committed);
+    return true;
+}
+
+auto Overlay::get_dirty_blocks() const -> size_t {
+    auto r = 0uz;
+    for(const auto& [begin, end] : extents) {
+        r += end - begin;
+    }
+    return r;
+}
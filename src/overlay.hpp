@@ -0,0 +1,32 @@
+#pragma once
+#include <functional>
+#include <map>
+#include <string_view>
+
+#include "util/fd.hpp"
+
+// copy-on-write layer over a lun, keyed by chip serial and lun number
+// written blocks go to a sparse delta file at their natural offsets, the extent file records which ranges are valid
+// nothing reaches the device until commit()
+class Overlay {
+  private:
+    FileDescriptor           data_fd;
+    FileDescriptor           map_fd;
+    std::map<size_t, size_t> extents; // begin -> end in blocks, never overlapping or adjacent
+    bool                     dirty = false;
+
+  public:
+    // reads or writes blocks of the underlying device
+    using Transfer = std::function<bool(size_t block, size_t blocks, std::byte* buf)>;
+
+    size_t block_size = 0;
+
+    auto open(std::string_view dir, std::string_view serial, int disk, size_t block_size) -> bool;
+    // fills blocks not in the overlay with read_base
+    auto read(size_t block, size_t blocks, std::byte* buf, const Transfer& read_base) -> bool;
+    auto write(size_t block, size_t blocks, const std::byte* buf) -> bool;
+    auto sync() -> bool;
+    // writes every extent to the device in ascending order and empties the overlay
+    auto commit(const Transfer& write_base) -> bool;
+    auto get_dirty_blocks() const -> size_t;
+};
@@ -1,12 +1,14 @@
 #include <array>
 #include <cstring>
+#include <format>
 
 #include <unistd.h>
 
 #include "abstract-device.hpp"
+#include "buffer-pool.hpp"
+#include "loader-library.hpp"
 #include "macros/unwrap.hpp"
-#include "sahara.hpp"
-#include "util/file-io.hpp"
+#include "sahara-actions.hpp"
 
 namespace {
 auto receive_hello(Device& dev) -> bool {
@@ -19,7 +21,7 @@ auto receive_hello(Device& dev) -> bool {
     return true;
 }
 
-auto get_exec_command_payload(Device& dev, const sahara::ExecCommand command) -> std::optional<std::vector<std::byte>> {
+auto get_exec_command_payload(Device& dev, const sahara::ExecCommand command) -> std::optional<pool::Buffer> {
     const auto cmd = sahara::packet::Exec{
         .command = command,
     };
@@ -33,7 +35,8 @@ auto get_exec_command_payload(Device& dev, const sahara::ExecCommand command) ->
     };
     ensure(dev.write(&payload_req, sizeof(payload_req)), "failed to send exec data command");
 
-    auto payload = std::vector<std::byte>(res.data_size);
+    auto payload = pool::acquire(res.data_size);
+    ensure(!payload.empty(), "failed to allocate buffer");
     ensure(dev.read_struct(payload.data(), payload.size()), "failed to read payload");
     return payload;
 }
@@ -49,6 +52,90 @@ auto send_done(Device& dev) -> bool {
     return true;
 }
 
+// the table repeats the hash to fill the payload
+auto trim_pkhash(const pool::Buffer& payload) -> std::span<const std::byte> {
+    if(payload.size() < 4) {
+        return payload.span();
+    }
+    const auto head = *std::bit_cast<uint32_t*>(payload.data());
+    auto       size = payload.size();
+    for(auto i = 4uz; i + 4 <= size; i += 4) {
+        const auto block = *std::bit_cast<uint32_t*>(payload.data() + i);
+        if(block == head) {
+            size = i;
+        }
+    }
+    return payload.span().first(size);
+}
+
+auto read_ids(Device& dev) -> std::optional<loader::Ids> {
+    unwrap(hwid_payload, get_exec_command_payload(dev, sahara::ExecCommand::ReadMSMHardwareID));
+    ensure(hwid_payload.size() >= 8, "hwid payload too short");
+    auto ids = loader::Ids();
+    memcpy(&ids.hwid, hwid_payload.data(), sizeof(ids.hwid));
+
+    unwrap(pkhash_payload, get_exec_command_payload(dev, sahara::ExecCommand::ReadOEMPubKeyHashTable));
+    for(const auto b : trim_pkhash(pkhash_payload)) {
+        ids.pkhash += std::format("{:02x}", int(b));
+    }
+    return ids;
+}
+
+// serves ReadData requests from the image until the device is done
+auto upload_image(Device& dev, const std::span<const std::byte> programmer) -> bool {
+    std::println("uploading edl programmer, size={}bytes\n", programmer.size());
+
+    const auto hello = sahara::packet::HelloResponse{
+        .version           = 2,
+        .supported_version = 2,
+        .status            = sahara::Status::Success,
+        .mode              = sahara::Mode::ImageTxPending,
+        .reserved          = {0, 0, 0, 0, 0, 0},
+    };
+    ensure(dev.write(&hello, sizeof(hello)), "failed to send hello response");
+
+    auto buf = std::array<std::byte, sizeof(sahara::packet::ReadData64)>();
+    while(true) {
+        ensure(dev.read(buf.data(), buf.size()) >= int(sizeof(sahara::packet::Header)), "failed to receive next request");
+        const auto& header = *std::bit_cast<sahara::packet::Header*>(buf.data());
+        if(header.command == sahara::Command::Done) {
+            return send_done(dev);
+        }
+        if(header.command == sahara::Command::EndTransfer) {
+            const auto& packet = *std::bit_cast<sahara::packet::EndTransfer*>(buf.data());
+            ensure(packet.status == sahara::Status::Success, "failed to upload programmer");
+            return send_done(dev);
+        }
+        auto offset = uint64_t(0);
+        auto size   = uint64_t(0);
+        if(header.command == sahara::Command::ReadData) {
+            const auto& packet = *std::bit_cast<sahara::packet::ReadData*>(buf.data());
+            offset             = packet.offset;
+            size               = packet.size;
+        } else if(header.command == sahara::Command::ReadData64) {
+            const auto& packet = *std::bit_cast<sahara::packet::ReadData64*>(buf.data());
+            offset             = packet.offset;
+            size               = packet.size;
+        } else {
+            bail("unexpected command");
+        }
+        std::println("request 0x{:x}+0x{:x}\n", offset, size);
+        if(offset + size < programmer.size()) {
+            dev.write(programmer.data() + offset, size);
+        } else {
+            // past the end of the image, pad with 0xff
+            const auto b = pool::acquire(size);
+            ensure(!b.empty(), "failed to allocate buffer");
+            const auto copy = offset < programmer.size() ? programmer.size() - offset : 0;
+            if(copy != 0) {
+                memcpy(b.data(), programmer.data() + offset, copy);
+            }
+            std::fill(b.data() + copy, b.data() + size, std::byte(0xff));
+            dev.write(b.data(), size);
+        }
+    }
+}
+
 auto print_hex(const std::string_view label, const std::span<const std::byte> data) -> void {
     std::print("{}: ", label);
     for(const auto b : data) {
@@ -58,8 +145,10 @@ auto print_hex(const std::string_view label, const std::span<const std::byte> da
 }
 } // namespace
 
-auto do_command_hello(Device& dev) -> bool {
-    ensure(receive_hello(dev));
+auto do_command_hello(Device& dev, const bool hello_received) -> bool {
+    if(!hello_received) {
+        ensure(receive_hello(dev));
+    }
 
     const auto res = sahara::packet::HelloResponse{
         .version           = 2,
@@ -77,9 +166,9 @@ auto do_command_hello(Device& dev) -> bool {
     return true;
 }
 
-auto do_switchmode(Device& dev) -> bool {
+auto do_switchmode(Device& dev, const sahara::Mode mode) -> bool {
     const auto res = sahara::packet::SwitchMode{
-        .mode = sahara::Mode::Command,
+        .mode = mode,
     };
     ensure(dev.write(&res, sizeof(res)), "failed to send swith mode command");
     return true;
@@ -96,7 +185,7 @@ auto do_reset(Device& dev) -> bool {
 
 auto do_get_serial_number(Device& dev) -> bool {
     unwrap(payload, get_exec_command_payload(dev, sahara::ExecCommand::ReadSerialNumber));
-    print_hex("serial-number", payload);
+    print_hex("serial-number", payload.span());
     return true;
 }
 
@@ -112,74 +201,34 @@ auto do_get_msm_hwid(Device& dev) -> bool {
 }
 
 auto do_get_pkhash(Device& dev) -> bool {
-    unwrap_mut(payload, get_exec_command_payload(dev, sahara::ExecCommand::ReadOEMPubKeyHashTable));
-
-    // remove duplicated part
-    const auto head = *std::bit_cast<uint32_t*>(payload.data());
-    for(auto i = 4uz; i + 4 <= payload.size(); i += 4) {
-        const auto block = *std::bit_cast<uint32_t*>(payload.data() + i);
-        if(block == head) {
-            payload.resize(i);
-        }
-    }
-    print_hex("pkhash", payload);
-
+    unwrap(payload, get_exec_command_payload(dev, sahara::ExecCommand::ReadOEMPubKeyHashTable));
+    print_hex("pkhash", trim_pkhash(payload));
     return true;
 }
 
-auto do_upload_hello(Device& dev, const char* const programmer_path) -> bool {
-    ensure(receive_hello(dev));
-    unwrap(programmer, read_file(programmer_path));
-    std::println("uploading edl programmer, size={}bytes\n", programmer.size());
-
-    const auto hello = sahara::packet::HelloResponse{
-        .version           = 2,
-        .supported_version = 2,
-        .status            = sahara::Status::Success,
-        .mode              = sahara::Mode::ImageTxPending,
-        .reserved          = {0, 0, 0, 0, 0, 0},
-    };
-    ensure(dev.write(&hello, sizeof(hello)), "failed to send hello response");
-
-    auto buf = std::array<std::byte, sizeof(sahara::packet::ReadData64)>();
-    while(true) {
-        ensure(dev.read(buf.data(), buf.size()) >= int(sizeof(sahara::packet::Header)), "failed to receive next request");
-        const auto& header = *std::bit_cast<sahara::packet::Header*>(buf.data());
-        if(header.command == sahara::Command::Done) {
-            return send_done(dev);
-        }
-        if(header.command == sahara::Command::EndTransfer) {
-            const auto& packet = *std::bit_cast<sahara::packet::EndTransfer*>(buf.data());
-            ensure(packet.status == sahara::Status::Success, "failed to upload programmer");
-            return send_done(dev);
-        }
-        auto offset = uint64_t(0);
-        auto size   = uint64_t(0);
-        if(header.command == sahara::Command::ReadData) {
-            const auto& packet = *std::bit_cast<sahara::packet::ReadData*>(buf.data());
-            offset             = packet.offset;
-            size               = packet.size;
-        } else if(header.command == sahara::Command::ReadData64) {
-            const auto& packet = *std::bit_cast<sahara::packet::ReadData64*>(buf.data());
-            offset             = packet.offset;
-            size               = packet.size;
-        } else {
-            bail("unexpected command");
-        }
-        std::println("request 0x{:x}+0x{:x}\n", offset, size);
-        if(offset + size < programmer.size()) {
-            dev.write(programmer.data() + offset, size);
-        } else if(offset >= programmer.size()) {
-            auto b = std::vector<std::byte>(size);
-            std::fill(b.begin(), b.end(), std::byte(0xff));
-            dev.write(b.data(), size);
-        } else {
-            auto b = std::vector<std::byte>(size);
-            memcpy(b.data(), programmer.data() + offset, programmer.size() - offset);
-            std::fill(b.begin() + programmer.size() - offset, b.end(), std::byte(0xff));
-            dev.write(b.data(), size);
-        }
+auto do_upload_hello(Device& dev, const char* const programmer_path, const bool hello_received) -> bool {
+    if(!hello_received) {
+        ensure(receive_hello(dev));
     }
+    unwrap(programmer, loader::map_image(programmer_path));
+    return upload_image(dev, programmer.span());
+}
 
-    return true;
+auto do_upload_from_library(Device& dev, const std::string_view library_dir, const bool hello_received) -> bool {
+    auto library = loader::Library();
+    ensure(library.open(library_dir));
+
+    // identify the device in command mode, then switch back to receive the image
+    ensure(do_command_hello(dev, hello_received));
+    unwrap(ids, read_ids(dev));
+    std::println("hwid: {:016x}", ids.hwid);
+    std::println("pkhash: {}", ids.pkhash);
+    const auto entry = library.find(ids);
+    ensure(entry != nullptr, "no loader for this device in {}", library_dir);
+    unwrap(programmer, loader::map_image(library.get_path(*entry)));
+    std::println("selected loader {}", entry->name);
+
+    ensure(do_switchmode(dev, sahara::Mode::ImageTxPending));
+    ensure(receive_hello(dev));
+    return upload_image(dev, programmer.span());
 }
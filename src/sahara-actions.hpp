@@ -1,10 +1,17 @@
+#pragma once
+#include <string_view>
+
 #include "abstract-device.hpp"
+#include "sahara.hpp"
 
-auto do_command_hello(Device& dev) -> bool;
-auto do_switchmode(Device& dev) -> bool;
+// hello_received: the hello was already read, e.g. by attach::probe
+auto do_command_hello(Device& dev, bool hello_received = false) -> bool;
+auto do_switchmode(Device& dev, sahara::Mode mode = sahara::Mode::Command) -> bool;
 auto do_reset(Device& dev) -> bool;
 auto do_get_serial_number(Device& dev) -> bool;
 auto do_get_msm_hwid(Device& dev) -> bool;
 auto do_get_pkhash(Device& dev) -> bool;
-auto do_upload_hello(Device& dev, const char* programmer_path) -> bool;
+auto do_upload_hello(Device& dev, const char* programmer_path, bool hello_received = false) -> bool;
+// reads hwid and pkhash in command mode and uploads the matching loader, see loader-library.hpp
+auto do_upload_from_library(Device& dev, std::string_view library_dir, bool hello_received = false) -> bool;
 
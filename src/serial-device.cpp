@@ -1,13 +1,16 @@
 #include <cstring>
 
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <termios.h>
 
 #include "abstract-device.hpp"
 #include "config.hpp"
-#include "macros/assert.hpp"
+#include "macros/unwrap.hpp"
 #include "sahara-packet-stringnize.hpp"
+#include "serial-device.hpp"
+#include "uring-device.hpp"
 #include "util/fd.hpp"
 
 namespace {
@@ -24,6 +27,7 @@ auto dump_bin(const std::byte* const ptr, const size_t size) -> void {
     }
     printf("\n");
 }
+} // namespace
 
 auto dump_packet(const std::byte* const ptr, const size_t size) -> void {
     if(size == 0) {
@@ -46,7 +50,23 @@ auto dump_packet(const std::byte* const ptr, const size_t size) -> void {
         std::println("{}", str);
     }
 }
-} // namespace
+
+auto open_serial_port(const char* const tty_dev) -> std::optional<FileDescriptor> {
+    const auto devfd = open(tty_dev, O_RDWR);
+    ensure(devfd >= 0, "failed to open device errno={}({})", errno, strerror(errno));
+    auto dev = FileDescriptor(devfd);
+
+    auto tio = termios{};
+    memset(&tio, 0, sizeof(tio));
+    tio.c_cflag = CREAD | CLOCAL | CS8;
+    ensure(cfsetispeed(&tio, B115200) == 0);
+    ensure(cfsetospeed(&tio, B115200) == 0);
+    cfmakeraw(&tio);
+    ensure(tcsetattr(devfd, TCSANOW, &tio) == 0);
+    ensure(ioctl(devfd, TCSETS, &tio) == 0, "setup tty failed errno={}({})", errno, strerror(errno));
+
+    return dev;
+}
 
 class SerialDevice : public Device {
   private:
@@ -85,26 +105,25 @@ class SerialDevice : public Device {
         return res;
     }
 
+    auto wait_readable(const int timeout_ms) -> bool override {
+        auto pfd = pollfd{.fd = fd.as_handle(), .events = POLLIN};
+        return poll(&pfd, 1, timeout_ms) > 0;
+    }
+
     SerialDevice(FileDescriptor fd) : fd(std::move(fd)) {}
 
     static auto setup(const char* const tty_dev) -> SerialDevice* {
-        const auto devfd = open(tty_dev, O_RDWR);
-        ensure(devfd >= 0, "failed to open device errno={}({})", errno, strerror(errno));
-        auto dev = FileDescriptor(devfd);
-
-        auto tio = termios{};
-        memset(&tio, 0, sizeof(tio));
-        tio.c_cflag = CREAD | CLOCAL | CS8;
-        ensure(cfsetispeed(&tio, B115200) == 0);
-        ensure(cfsetospeed(&tio, B115200) == 0);
-        cfmakeraw(&tio);
-        ensure(tcsetattr(devfd, TCSANOW, &tio) == 0);
-        ensure(ioctl(devfd, TCSETS, &tio) == 0, "setup tty failed errno={}({})", errno, strerror(errno));
-
-        return new SerialDevice(std::move(dev));
+        unwrap_mut(fd, open_serial_port(tty_dev));
+        return new SerialDevice(std::move(fd));
     }
 };
 
 auto setup_serial_device(const char* const tty_dev) -> Device* {
+    if(config::use_io_uring) {
+        if(const auto dev = setup_uring_serial_device(tty_dev); dev != nullptr) {
+            return dev;
+        }
+        std::println("io_uring is not available, falling back to blocking io");
+    }
     return SerialDevice::setup(tty_dev);
 }
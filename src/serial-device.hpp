@@ -1,4 +1,12 @@
 #pragma once
+#include <optional>
+
 #include "abstract-device.hpp"
+#include "util/fd.hpp"
+
+// prints xml or sahara packets when config::dump_serial_io is set
+auto dump_packet(const std::byte* ptr, size_t size) -> void;
 
+// opens the tty in raw mode
+auto open_serial_port(const char* tty_dev) -> std::optional<FileDescriptor>;
 auto setup_serial_device(const char* const tty_dev) -> Device*;
@@ -0,0 +1,203 @@
+#include <bit>
+#include <cstring>
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#include "macros/unwrap.hpp"
+#include "sha256.hpp"
+#include "util/charconv.hpp"
+
+namespace sha256 {
+namespace {
+constexpr auto k = std::array<uint32_t, 64>{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+auto rotr(const uint32_t x, const int n) -> uint32_t {
+    return (x >> n) | (x << (32 - n));
+}
+
+auto load_be32(const std::byte* const p) -> uint32_t {
+    return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | uint32_t(p[3]);
+}
+
+auto transform(std::array<uint32_t, 8>& state, const std::byte* const block) -> void {
+    auto w = std::array<uint32_t, 64>();
+    for(auto i = 0; i < 16; i += 1) {
+        w[i] = load_be32(block + i * 4);
+    }
+    for(auto i = 16; i < 64; i += 1) {
+        const auto s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        const auto s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i]          = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    auto [a, b, c, d, e, f, g, h] = state;
+    for(auto i = 0; i < 64; i += 1) {
+        const auto s1  = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+        const auto ch  = (e & f) ^ (~e & g);
+        const auto t1  = h + s1 + ch + k[i] + w[i];
+        const auto s0  = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+        const auto maj = (a & b) ^ (a & c) ^ (b & c);
+        const auto t2  = s0 + maj;
+        h              = g;
+        g              = f;
+        f              = e;
+        e              = d + t1;
+        d              = c;
+        c              = b;
+        b              = a;
+        a              = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+// intel sha extensions, hashes consecutive blocks
+[[gnu::target("sha,sse4.1")]] auto transform_shani(std::array<uint32_t, 8>& state, const std::byte* block, size_t blocks) -> void {
+    const auto shuffle = _mm_set_epi64x(0x0c0d0e0f08090a0bull, 0x0405060700010203ull);
+
+    // state as abef/cdgh
+    auto tmp    = _mm_loadu_si128(std::bit_cast<const __m128i*>(&state[0]));
+    auto state1 = _mm_loadu_si128(std::bit_cast<const __m128i*>(&state[4]));
+    tmp         = _mm_shuffle_epi32(tmp, 0xb1);
+    state1      = _mm_shuffle_epi32(state1, 0x1b);
+    auto state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1      = _mm_blend_epi16(state1, tmp, 0xf0);
+
+    for(; blocks > 0; blocks -= 1, block += 64) {
+        const auto save0 = state0;
+        const auto save1 = state1;
+
+        __m128i msgs[4];
+        for(auto i = 0; i < 4; i += 1) {
+            msgs[i] = _mm_shuffle_epi8(_mm_loadu_si128(std::bit_cast<const __m128i*>(block + i * 16)), shuffle);
+        }
+        for(auto i = 0; i < 16; i += 1) {
+            auto& m   = msgs[i % 4];
+            auto  msg = _mm_add_epi32(m, _mm_loadu_si128(std::bit_cast<const __m128i*>(&k[i * 4])));
+            state1    = _mm_sha256rnds2_epu32(state1, state0, msg);
+            msg       = _mm_shuffle_epi32(msg, 0x0e);
+            state0    = _mm_sha256rnds2_epu32(state0, state1, msg);
+            if(i < 12) {
+                // schedule the words used four groups later
+                auto& next = msgs[(i + 1) % 4];
+                auto& last = msgs[(i + 3) % 4];
+                m          = _mm_sha256msg1_epu32(m, next);
+                m          = _mm_add_epi32(m, _mm_alignr_epi8(last, msgs[(i + 2) % 4], 4));
+                m          = _mm_sha256msg2_epu32(m, last);
+            }
+        }
+        state0 = _mm_add_epi32(state0, save0);
+        state1 = _mm_add_epi32(state1, save1);
+    }
+
+    tmp    = _mm_shuffle_epi32(state0, 0x1b);
+    state1 = _mm_shuffle_epi32(state1, 0xb1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+    _mm_storeu_si128(std::bit_cast<__m128i*>(&state[0]), state0);
+    _mm_storeu_si128(std::bit_cast<__m128i*>(&state[4]), state1);
+}
+
+auto transform_generic(std::array<uint32_t, 8>& state, const std::byte* block, size_t blocks) -> void {
+    for(; blocks > 0; blocks -= 1, block += 64) {
+        transform(state, block);
+    }
+}
+
+auto has_shani() -> bool {
+    auto a = 0u, b = 0u, c = 0u, d = 0u;
+    return __get_cpuid_count(7, 0, &a, &b, &c, &d) != 0 && (b & bit_SHA) != 0;
+}
+
+const auto transform_blocks = has_shani() ? transform_shani : transform_generic;
+} // namespace
+
+auto Context::update(std::span<const std::byte> data) -> void {
+    total_len += data.size();
+    if(block_len != 0) {
+        const auto len = std::min(data.size(), block.size() - block_len);
+        memcpy(block.data() + block_len, data.data(), len);
+        block_len += len;
+        data = data.subspan(len);
+        if(block_len < block.size()) {
+            return;
+        }
+        transform_blocks(state, block.data(), 1);
+        block_len = 0;
+    }
+    const auto blocks = data.size() / block.size();
+    transform_blocks(state, data.data(), blocks);
+    data = data.subspan(blocks * block.size());
+    memcpy(block.data(), data.data(), data.size());
+    block_len = data.size();
+}
+
+auto Context::finish() -> Digest {
+    const auto bits = total_len * 8;
+
+    auto pad = std::array<std::byte, 72>();
+    pad[0]   = std::byte(0x80);
+    // pad to 56 mod 64, then append the length
+    const auto pad_len = (block_len < 56 ? 56 : 120) - block_len;
+    for(auto i = 0; i < 8; i += 1) {
+        pad[pad_len + i] = std::byte(bits >> (56 - i * 8));
+    }
+    update({pad.data(), pad_len + 8});
+
+    auto r = Digest();
+    for(auto i = 0; i < 8; i += 1) {
+        r[i * 4 + 0] = std::byte(state[i] >> 24);
+        r[i * 4 + 1] = std::byte(state[i] >> 16);
+        r[i * 4 + 2] = std::byte(state[i] >> 8);
+        r[i * 4 + 3] = std::byte(state[i]);
+    }
+    return r;
+}
+
+Context::Context()
+    : state{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19} {}
+
+auto digest(const std::span<const std::byte> data) -> Digest {
+    auto ctx = Context();
+    ctx.update(data);
+    return ctx.finish();
+}
+
+auto to_hex(const Digest& digest) -> std::string {
+    constexpr auto chars = "0123456789abcdef";
+
+    auto r = std::string();
+    r.reserve(digest.size() * 2);
+    for(const auto b : digest) {
+        r.push_back(chars[int(b) >> 4]);
+        r.push_back(chars[int(b) & 0x0f]);
+    }
+    return r;
+}
+
+auto from_hex(const std::string_view hex) -> std::optional<Digest> {
+    auto r = Digest();
+    ensure(hex.size() >= r.size() * 2, "malformed digest");
+    for(auto i = 0uz; i < r.size(); i += 1) {
+        unwrap(byte, from_chars<uint8_t>(hex.substr(i * 2, 2), 16), "malformed digest");
+        r[i] = std::byte(byte);
+    }
+    return r;
+}
+} // namespace sha256
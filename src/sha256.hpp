@@ -0,0 +1,30 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace sha256 {
+using Digest = std::array<std::byte, 32>;
+
+class Context {
+  private:
+    std::array<uint32_t, 8>   state;
+    std::array<std::byte, 64> block;
+    size_t                    block_len = 0;
+    uint64_t                  total_len = 0;
+
+  public:
+    auto update(std::span<const std::byte> data) -> void;
+    auto finish() -> Digest;
+
+    Context();
+};
+
+auto digest(std::span<const std::byte> data) -> Digest;
+auto to_hex(const Digest& digest) -> std::string;
+// parses the first 64 hex digits
+auto from_hex(std::string_view hex) -> std::optional<Digest>;
+} // namespace sha256
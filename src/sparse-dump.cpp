@@ -0,0 +1,64 @@
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "buffer-pool.hpp"
+#include "config.hpp"
+#include "firehose-actions.hpp"
+#include "fs-allocation.hpp"
+#include "macros/unwrap.hpp"
+#include "sparse-dump.hpp"
+
+namespace {
+// reading a small gap costs less than another command round trip
+constexpr auto merge_gap_bytes = 1024uz * 1024;
+
+auto merge_runs(const std::vector<fsalloc::Run>& runs) -> std::vector<fsalloc::Run> {
+    const auto merge_gap = merge_gap_bytes / fh::bytes_per_sector;
+
+    auto r = std::vector<fsalloc::Run>();
+    for(const auto& run : runs) {
+        if(!r.empty() && r.back().sector_begin + r.back().num_sectors + merge_gap >= run.sector_begin) {
+            r.back().num_sectors = run.sector_begin + run.num_sectors - r.back().sector_begin;
+        } else {
+            r.push_back(run);
+        }
+    }
+    return r;
+}
+} // namespace
+
+auto sparse_read_to_file(Device& dev, const std::string_view args_str) -> bool {
+    auto args = fh::RWArgs();
+    ensure(fh::parse_rw_args(args_str, args));
+
+    unwrap(allocated, fsalloc::find_allocated(dev, args.disk, args.sector_begin, args.num_sectors));
+    const auto runs = merge_runs(allocated);
+
+    auto total = 0uz;
+    for(const auto& run : runs) {
+        total += run.num_sectors;
+    }
+    std::println("reading {} of {} sectors in {} runs", total, args.num_sectors, runs.size());
+
+    const auto output_fd = open(std::string(args.file).data(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ensure(output_fd >= 0, "failed to open {} errno={}({})", args.file, errno, strerror(errno));
+    // holes read as zero
+    ensure(ftruncate(output_fd, args.num_sectors * fh::bytes_per_sector) == 0);
+
+    const auto buf = pool::acquire(config::file_buffer_bytes);
+    ensure(!buf.empty(), "failed to allocate buffer");
+    for(const auto& run : runs) {
+        for(auto sector = run.sector_begin; sector < run.sector_begin + run.num_sectors;) {
+            const auto sectors = std::min(buf.size() / fh::bytes_per_sector, run.sector_begin + run.num_sectors - sector);
+            const auto bytes   = sectors * fh::bytes_per_sector;
+            ensure(fh::read_disk_around_bad(dev, args.disk, args.sector_begin + sector, sectors, buf.data()));
+            ensure(pwrite(output_fd, buf.data(), bytes, sector * fh::bytes_per_sector) == ssize_t(bytes), "failed to write output");
+            sector += sectors;
+        }
+    }
+    ensure(close(output_fd) == 0);
+    return true;
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include <string_view>
+
+#include "abstract-device.hpp"
+
+// same arguments as fh::read_to_file
+// reads only the blocks allocated by the ext4/f2fs filesystem in the range, the rest of the output file is left as holes
+auto sparse_read_to_file(Device& dev, std::string_view args) -> bool;
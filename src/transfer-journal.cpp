@@ -0,0 +1,143 @@
+#include <array>
+#include <bit>
+#include <cstring>
+#include <optional>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.hpp"
+#include "macros/assert.hpp"
+#include "transfer-journal.hpp"
+
+namespace {
+constexpr auto magic = std::array{'E', 'D', 'L', 'J', '0', '0', '0', '2'};
+
+// which file the journal describes
+struct Identity {
+    uint64_t size;
+    uint64_t ino;
+    int64_t  time_ns;
+};
+
+auto to_ns(const statx_timestamp& ts) -> int64_t {
+    return ts.tv_sec * 1'000'000'000 + ts.tv_nsec;
+}
+
+// nullopt if the file does not exist
+// a flashed file must be unchanged, so its size and mtime are compared
+// a dump is rewritten in place and resized on open, only its inode and creation time tell it from a file recreated under the same name
+auto get_identity(const std::string& path, const TransferJournal::Kind kind) -> std::optional<Identity> {
+    struct statx st;
+    if(statx(AT_FDCWD, path.data(), 0, STATX_INO | STATX_SIZE | STATX_MTIME | STATX_BTIME, &st) != 0) {
+        return std::nullopt;
+    }
+    if(kind == TransferJournal::Kind::Write) {
+        return Identity{st.stx_size, st.stx_ino, to_ns(st.stx_mtime)};
+    }
+    return Identity{0, st.stx_ino, st.stx_mask & STATX_BTIME ? to_ns(st.stx_btime) : 0};
+}
+} // namespace
+
+struct TransferJournal::Header {
+    std::array<char, 8> magic;
+    Kind                kind;
+    uint32_t            reserved;
+    uint64_t            disk;
+    uint64_t            sector_begin;
+    uint64_t            num_sectors;
+    uint64_t            chunk_sectors;
+    uint64_t            data_size;
+    uint64_t            data_ino;
+    int64_t             data_time_ns;
+};
+
+auto TransferJournal::open(const std::string_view data_path, const Kind kind, const size_t disk, const size_t sector_begin, const size_t num_sectors, const size_t chunk_sectors, const bool sync_data) -> bool {
+    path        = std::string(data_path) + (kind == Kind::Read ? ".read-journal" : ".write-journal");
+    chunk_count = (num_sectors + chunk_sectors - 1) / chunk_sectors;
+    map_len     = sizeof(Header) + (chunk_count + 7) / 8;
+
+    journal_fd = FileDescriptor(::open(path.data(), O_RDWR | O_CREAT, 0644));
+    ensure(journal_fd.as_handle() >= 0, "failed to open {} errno={}({})", path, errno, strerror(errno));
+    // taken before the dump is created, a journal never matches a file that was deleted in between
+    const auto data_path_str = std::string(data_path);
+    const auto found         = get_identity(data_path_str, kind);
+    if(sync_data) {
+        data_fd = FileDescriptor(::open(data_path_str.data(), O_RDONLY | O_CREAT, 0644));
+        ensure(data_fd.as_handle() >= 0, "failed to open {} errno={}({})", data_path, errno, strerror(errno));
+    }
+    const auto identity = found ? found : get_identity(data_path_str, kind);
+    ensure(identity, "failed to stat {} errno={}({})", data_path, errno, strerror(errno));
+
+    const auto expected = Header{magic, kind, 0, disk, sector_begin, num_sectors, chunk_sectors, identity->size, identity->ino, identity->time_ns};
+    auto       header   = Header();
+    const auto resumed  = found && pread(journal_fd.as_handle(), &header, sizeof(header), 0) == sizeof(header) &&
+                         memcmp(&header, &expected, sizeof(header)) == 0;
+    if(!resumed) {
+        // a journal of another transfer or another file is of no use
+        ensure(ftruncate(journal_fd.as_handle(), 0) == 0);
+        ensure(pwrite(journal_fd.as_handle(), &expected, sizeof(expected), 0) == sizeof(expected));
+    }
+    ensure(ftruncate(journal_fd.as_handle(), map_len) == 0);
+
+    map = mmap(nullptr, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, journal_fd.as_handle(), 0);
+    ensure(map != MAP_FAILED, "failed to map journal errno={}({})", errno, strerror(errno));
+    bitmap = static_cast<uint8_t*>(map) + sizeof(Header);
+    if(resumed) {
+        std::println("resuming, {} of {} chunks already done", get_done_count(), chunk_count);
+    }
+    return true;
+}
+
+auto TransferJournal::is_done(const size_t chunk) const -> bool {
+    return bitmap[chunk / 8] & (1 << (chunk % 8));
+}
+
+auto TransferJournal::get_done_count() const -> size_t {
+    auto r = 0uz;
+    for(auto i = 0uz; i < (chunk_count + 7) / 8; i += 1) {
+        r += std::popcount(bitmap[i]);
+    }
+    return r;
+}
+
+auto TransferJournal::mark_done(const size_t chunk) -> bool {
+    pending.push_back(chunk);
+    if(pending.size() >= config::journal_sync_chunks) {
+        ensure(flush());
+    }
+    return true;
+}
+
+auto TransferJournal::flush() -> bool {
+    if(pending.empty()) {
+        return true;
+    }
+    // the data must reach the disk before the journal claims it
+    if(data_fd.as_handle() >= 0) {
+        ensure(fdatasync(data_fd.as_handle()) == 0, "failed to sync data errno={}({})", errno, strerror(errno));
+    }
+    for(const auto chunk : pending) {
+        bitmap[chunk / 8] |= 1 << (chunk % 8);
+    }
+    pending.clear();
+    ensure(msync(map, map_len, MS_SYNC) == 0, "failed to sync journal errno={}({})", errno, strerror(errno));
+    return true;
+}
+
+auto TransferJournal::remove() -> bool {
+    pending.clear();
+    ensure(unlink(path.data()) == 0, "failed to remove {}", path);
+    return true;
+}
+
+TransferJournal::~TransferJournal() {
+    if(map == nullptr || map == MAP_FAILED) {
+        return;
+    }
+    // keeps the progress of a failed transfer
+    flush();
+    munmap(map, map_len);
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "util/fd.hpp"
+
+// progress of a long fhread/fhwrite, kept next to the file as "<file>.read-journal" or "<file>.write-journal"
+// the journal is a memory mapped header followed by a bitmap of completed chunks
+// rerunning the same transfer on the same file picks it up and skips the chunks already done
+class TransferJournal {
+  public:
+    enum class Kind : uint32_t {
+        Read  = 0,
+        Write = 1,
+    };
+
+  private:
+    struct Header;
+
+    std::string         path;
+    FileDescriptor      journal_fd;
+    FileDescriptor      data_fd; // synced before completed chunks are recorded, -1 if nothing to sync
+    void*               map     = nullptr;
+    size_t              map_len = 0;
+    uint8_t*            bitmap  = nullptr;
+    std::vector<size_t> pending;
+
+  public:
+    size_t chunk_count = 0;
+
+    // data_path is the dumped or flashed file, sync_data is needed when it is the destination
+    // a destination is created if missing, so the journal must be opened before anything else creates it
+    auto open(std::string_view data_path, Kind kind, size_t disk, size_t sector_begin, size_t num_sectors, size_t chunk_sectors, bool sync_data) -> bool;
+    auto is_done(size_t chunk) const -> bool;
+    auto get_done_count() const -> size_t;
+    // records are batched, see config::journal_sync_chunks
+    auto mark_done(size_t chunk) -> bool;
+    auto flush() -> bool;
+    // called after the transfer completed
+    auto remove() -> bool;
+
+    ~TransferJournal();
+};
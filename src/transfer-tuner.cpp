@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <utility>
+
+#include "config.hpp"
+#include "firehose-actions.hpp"
+#include "transfer-tuner.hpp"
+
+namespace {
+constexpr auto samples_per_probe = 2uz;
+constexpr auto average_weight    = 0.25;
+constexpr auto switch_margin     = 1.05; // a probed size must be this much faster to be taken
+} // namespace
+
+auto TransferTuner::within_budget(const size_t index) const -> bool {
+    return stats[index].latency * 1000 <= config::tune_latency_budget_ms;
+}
+
+auto TransferTuner::choose() -> void {
+    auto best = current;
+    for(auto i = 0uz; i < candidates.size(); i += 1) {
+        if(stats[i].samples != 0 && within_budget(i) && stats[i].throughput > stats[best].throughput * (i == current ? 1.0 : switch_margin)) {
+            best = i;
+        }
+    }
+    if(best != current || !within_budget(current)) {
+        changed |= best != current;
+        current = best;
+    }
+}
+
+auto TransferTuner::get_sectors(const size_t remaining) const -> size_t {
+    return config::autotune ? std::min(remaining, candidates[trying]) : remaining;
+}
+
+auto TransferTuner::record(const size_t sectors, const std::chrono::steady_clock::duration elapsed) -> void {
+    // short tail commands say little about the size
+    if(!config::autotune || sectors != candidates[trying]) {
+        return;
+    }
+    const auto seconds    = std::max(std::chrono::duration<double>(elapsed).count(), 1e-6);
+    const auto throughput = sectors * fh::bytes_per_sector / seconds;
+    auto&      stat       = stats[trying];
+    if(stat.samples == 0) {
+        stat.throughput = throughput;
+        stat.latency    = seconds;
+    } else {
+        stat.throughput += (throughput - stat.throughput) * average_weight;
+        stat.latency += (seconds - stat.latency) * average_weight;
+    }
+    stat.samples += 1;
+    commands += 1;
+
+    if(exploring) {
+        if(stat.samples < samples_per_probe) {
+            return;
+        }
+        // climb while larger commands are faster and within the budget
+        const auto better = trying == 0 || stats[trying].throughput > stats[trying - 1].throughput;
+        if(trying + 1 < candidates.size() && better && within_budget(trying)) {
+            trying += 1;
+            return;
+        }
+        // take the fastest size within the budget, the smallest one if none is
+        exploring = false;
+        current   = 0;
+        for(auto i = 0uz; i < candidates.size(); i += 1) {
+            if(stats[i].samples != 0 && within_budget(i) && stats[i].throughput > stats[current].throughput) {
+                current = i;
+            }
+        }
+        changed = true;
+        trying  = current;
+        return;
+    }
+
+    if(trying != current) {
+        // probing a neighbour
+        if(stat.samples % samples_per_probe == 0) {
+            choose();
+            trying = current;
+        }
+        return;
+    }
+    if(commands % config::tune_probe_interval == 0) {
+        const auto up = (commands / config::tune_probe_interval) % 2 == 0;
+        if(up && current + 1 < candidates.size()) {
+            trying = current + 1;
+        } else if(!up && current > 0) {
+            trying = current - 1;
+        }
+    }
+}
+
+auto TransferTuner::take_changed() -> bool {
+    return std::exchange(changed, false);
+}
+
+auto TransferTuner::get_current() const -> size_t {
+    return candidates[current];
+}
+
+auto TransferTuner::set_current(const size_t sectors) -> void {
+    const auto it = std::ranges::find(candidates, sectors);
+    if(it == candidates.end()) {
+        return;
+    }
+    current   = it - candidates.begin();
+    trying    = current;
+    exploring = false;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <string>
+
+// picks the number of sectors per firehose read/program command
+// the first commands of a session climb through the candidate sizes from the smallest, then the best one within
+// config::tune_latency_budget is used and its neighbours are probed from time to time
+class TransferTuner {
+  public:
+    static constexpr auto candidates = std::array{16uz, 32uz, 64uz, 128uz, 256uz, 512uz, 1024uz, 2048uz, 4096uz};
+
+  private:
+    struct Stat {
+        double throughput = 0; // bytes per second, moving average
+        double latency    = 0; // seconds per command, moving average
+        size_t samples    = 0;
+    };
+
+    std::array<Stat, candidates.size()> stats;
+    size_t                              current   = 0;
+    size_t                              trying    = 0; // candidate the next full-size command uses
+    size_t                              commands  = 0;
+    bool                                exploring = true;
+    bool                                changed   = false;
+
+    auto within_budget(size_t index) const -> bool;
+    auto choose() -> void;
+
+  public:
+    auto get_sectors(size_t remaining) const -> size_t;
+    auto record(size_t sectors, std::chrono::steady_clock::duration elapsed) -> void;
+    // whether the choice changed since the last call
+    auto take_changed() -> bool;
+    auto get_current() const -> size_t;
+    // skips exploration
+    auto set_current(size_t sectors) -> void;
+};
@@ -0,0 +1,344 @@
+#include <array>
+#include <bit>
+#include <cstring>
+#include <deque>
+#include <span>
+#include <vector>
+
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "buffer-pool.hpp"
+#include "config.hpp"
+#include "macros/unwrap.hpp"
+#include "serial-device.hpp"
+#include "uring-device.hpp"
+
+namespace {
+constexpr auto ring_entries      = 8u;
+constexpr auto read_buffers      = 4uz;
+constexpr auto read_buffer_size  = 64uz * 1024;
+constexpr auto write_buffer_size = 1024uz * 1024;
+constexpr auto write_user_data   = uint64_t(read_buffers);
+constexpr auto cancel_user_data  = uint64_t(read_buffers + 1);
+
+// minimal io_uring wrapper on raw syscalls
+class Ring {
+  private:
+    int           fd = -1;
+    void*         sq_ptr;
+    size_t        sq_len;
+    void*         cq_ptr;
+    size_t        cq_len;
+    io_uring_sqe* sqes;
+    size_t        sqes_len;
+    unsigned*     sq_head;
+    unsigned*     sq_tail;
+    unsigned*     sq_mask;
+    unsigned*     sq_array;
+    unsigned*     cq_head;
+    unsigned*     cq_tail;
+    unsigned*     cq_mask;
+    io_uring_cqe* cqes;
+    unsigned      pending = 0;
+
+  public:
+    auto init(const unsigned entries) -> bool {
+        auto params = io_uring_params{};
+        fd          = syscall(__NR_io_uring_setup, entries, &params);
+        ensure(fd >= 0, "io_uring_setup failed errno={}({})", errno, strerror(errno));
+
+        sq_len   = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_len   = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        sqes_len = params.sq_entries * sizeof(io_uring_sqe);
+        sq_ptr   = mmap(nullptr, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        ensure(sq_ptr != MAP_FAILED);
+        cq_ptr = mmap(nullptr, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        ensure(cq_ptr != MAP_FAILED);
+        sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+        ensure(sqes != MAP_FAILED);
+
+        const auto sq = static_cast<std::byte*>(sq_ptr);
+        const auto cq = static_cast<std::byte*>(cq_ptr);
+        sq_head       = std::bit_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail       = std::bit_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask       = std::bit_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array      = std::bit_cast<unsigned*>(sq + params.sq_off.array);
+        cq_head       = std::bit_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail       = std::bit_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask       = std::bit_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes          = std::bit_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    // readable when completions are pending
+    auto get_fd() const -> int {
+        return fd;
+    }
+
+    auto register_buffers(const std::span<const iovec> iovecs) -> bool {
+        return syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, iovecs.data(), iovecs.size()) == 0;
+    }
+
+    // the returned entry is queued and sent with the next submit()
+    auto get_sqe() -> io_uring_sqe* {
+        const auto tail = *sq_tail;
+        if(tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= ring_entries) {
+            return nullptr;
+        }
+        const auto index = tail & *sq_mask;
+        sq_array[index]  = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        pending += 1;
+        auto& sqe = sqes[index];
+        memset(&sqe, 0, sizeof(sqe));
+        return &sqe;
+    }
+
+    auto submit(const unsigned wait) -> bool {
+        while(true) {
+            const auto ret = syscall(__NR_io_uring_enter, fd, pending, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            if(ret < 0 && errno == EINTR) {
+                continue;
+            }
+            ensure(ret >= 0, "io_uring_enter failed errno={}({})", errno, strerror(errno));
+            pending -= ret;
+            return true;
+        }
+    }
+
+    template <class Fn>
+    auto for_each_cqe(Fn fn) -> void {
+        auto       head = *cq_head;
+        const auto tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        for(; head != tail; head += 1) {
+            fn(cqes[head & *cq_mask]);
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    ~Ring() {
+        if(fd < 0) {
+            return;
+        }
+        munmap(sqes, sqes_len);
+        munmap(cq_ptr, cq_len);
+        munmap(sq_ptr, sq_len);
+        close(fd);
+    }
+};
+
+struct ReadBuffer {
+    size_t index;
+    size_t size;
+    size_t consumed;
+};
+} // namespace
+
+class UringSerialDevice : public Device {
+  private:
+    FileDescriptor         fd;
+    Ring                   ring;
+    pool::Buffer           memory; // read buffers followed by the write buffer
+    bool                   fixed = false;
+    std::deque<ReadBuffer> received;
+    std::vector<size_t>    free_buffers;
+    int                    read_in_flight = -1;
+    bool                   write_in_flight = false;
+    int                    write_result    = 0;
+    bool                   cancel_in_flight = false;
+    bool                   failed           = false;
+
+    auto buffer(const size_t index) -> std::byte* {
+        return memory.data() + index * read_buffer_size;
+    }
+
+    auto prepare_rw(io_uring_sqe& sqe, const bool write, const size_t index, const size_t size, const uint64_t user_data) -> void {
+        sqe.opcode    = fixed ? (write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED) : (write ? IORING_OP_WRITE : IORING_OP_READ);
+        sqe.fd        = fd.as_handle();
+        sqe.addr      = std::bit_cast<uint64_t>(buffer(index));
+        sqe.len       = size;
+        sqe.off       = uint64_t(-1);
+        sqe.buf_index = index;
+        sqe.user_data = user_data;
+    }
+
+    // only one read may be in flight, concurrent reads on a stream could complete out of order
+    auto post_read() -> void {
+        if(read_in_flight >= 0 || free_buffers.empty() || failed) {
+            return;
+        }
+        const auto sqe = ring.get_sqe();
+        if(sqe == nullptr) {
+            return;
+        }
+        const auto index = free_buffers.back();
+        free_buffers.pop_back();
+        prepare_rw(*sqe, false, index, read_buffer_size, index);
+        read_in_flight = index;
+    }
+
+    auto reap() -> void {
+        ring.for_each_cqe([this](const io_uring_cqe& cqe) {
+            if(cqe.user_data == write_user_data) {
+                write_in_flight = false;
+                write_result    = cqe.res;
+            } else if(cqe.user_data == cancel_user_data) {
+                cancel_in_flight = false;
+            } else {
+                read_in_flight = -1;
+                if(cqe.res > 0) {
+                    received.push_back(ReadBuffer{size_t(cqe.user_data), size_t(cqe.res), 0});
+                } else {
+                    free_buffers.push_back(cqe.user_data);
+                    failed |= cqe.res != -ECANCELED;
+                }
+            }
+        });
+        post_read();
+    }
+
+    auto wait() -> bool {
+        ensure(ring.submit(1));
+        reap();
+        return true;
+    }
+
+  public:
+    auto clear_rx_buffer() -> bool override {
+        std::println("clearing received data");
+        if(read_in_flight >= 0) {
+            const auto sqe = ring.get_sqe();
+            ensure(sqe != nullptr);
+            sqe->opcode      = IORING_OP_ASYNC_CANCEL;
+            sqe->addr        = uint64_t(read_in_flight);
+            sqe->user_data   = cancel_user_data;
+            cancel_in_flight = true;
+            while(read_in_flight >= 0 || cancel_in_flight) {
+                ensure(ring.submit(1));
+                ring.for_each_cqe([this](const io_uring_cqe& cqe) {
+                    if(cqe.user_data == cancel_user_data) {
+                        cancel_in_flight = false;
+                    } else if(cqe.user_data < read_buffers) {
+                        read_in_flight = -1;
+                        free_buffers.push_back(cqe.user_data);
+                    }
+                });
+            }
+        }
+        for(const auto& r : received) {
+            free_buffers.push_back(r.index);
+        }
+        received.clear();
+        failed = false;
+        ensure(tcflush(fd.as_handle(), TCIFLUSH) == 0);
+        post_read();
+        return true;
+    }
+
+    auto write(const void* const ptr, const int size) -> bool override {
+        if(config::dump_serial_io) {
+            std::println("<- {}", size);
+            dump_packet((std::byte*)ptr, size);
+        }
+        auto done = 0uz;
+        while(done < size_t(size)) {
+            const auto len = std::min(size_t(size) - done, write_buffer_size);
+            memcpy(buffer(read_buffers), static_cast<const std::byte*>(ptr) + done, len);
+            const auto sqe = ring.get_sqe();
+            ensure(sqe != nullptr);
+            prepare_rw(*sqe, true, read_buffers, len, write_user_data);
+            write_in_flight = true;
+            post_read(); // batched with the write
+            while(write_in_flight) {
+                ensure(wait());
+            }
+            ensure(write_result > 0, "failed to write errno={}({})", -write_result, strerror(-write_result));
+            done += write_result;
+        }
+        return true;
+    }
+
+    auto read(void* const ptr, const int size) -> int override {
+        constexpr auto error_value = -1;
+
+        post_read();
+        while(received.empty()) {
+            ensure_v(!failed, "read failed");
+            ensure_v(wait());
+        }
+        auto&      front = received.front();
+        const auto len   = std::min(size_t(size), front.size - front.consumed);
+        memcpy(ptr, buffer(front.index) + front.consumed, len);
+        if(config::dump_serial_io) {
+            std::println("-> {}", len);
+            dump_packet((std::byte*)ptr, len);
+        }
+        front.consumed += len;
+        if(front.consumed == front.size) {
+            free_buffers.push_back(front.index);
+            received.pop_front();
+            post_read();
+        }
+        return len;
+    }
+
+    auto read_struct(void* const ptr, const int size) -> bool override {
+        auto done = 0;
+        while(done < size) {
+            const auto ret = read(static_cast<std::byte*>(ptr) + done, size - done);
+            ensure(ret > 0);
+            done += ret;
+        }
+        return true;
+    }
+
+    auto wait_readable(const int timeout_ms) -> bool override {
+        post_read();
+        ensure(ring.submit(0));
+        reap();
+        if(!received.empty()) {
+            return true;
+        }
+        ensure(ring.submit(0)); // the read reap() may have reposted
+        auto pfd = pollfd{.fd = ring.get_fd(), .events = POLLIN};
+        if(poll(&pfd, 1, timeout_ms) > 0) {
+            reap();
+        }
+        return !received.empty();
+    }
+
+    auto init() -> bool {
+        ensure(ring.init(ring_entries));
+        memory = pool::acquire(read_buffers * read_buffer_size + write_buffer_size);
+        ensure(!memory.empty(), "failed to allocate buffers");
+        auto iovecs = std::array<iovec, read_buffers + 1>();
+        for(auto i = 0uz; i < read_buffers; i += 1) {
+            iovecs[i] = iovec{buffer(i), read_buffer_size};
+            free_buffers.push_back(i);
+        }
+        iovecs[read_buffers] = iovec{buffer(read_buffers), write_buffer_size};
+        // registration may fail under a low RLIMIT_MEMLOCK, plain reads still work
+        fixed = ring.register_buffers(iovecs);
+        post_read();
+        ensure(ring.submit(0));
+        return true;
+    }
+
+    UringSerialDevice(FileDescriptor fd) : fd(std::move(fd)) {}
+};
+
+auto setup_uring_serial_device(const char* const tty_dev) -> Device* {
+    unwrap_mut(fd, open_serial_port(tty_dev));
+    auto dev = new UringSerialDevice(std::move(fd));
+    if(!dev->init()) {
+        delete dev;
+        return nullptr;
+    }
+    return dev;
+}
@@ -0,0 +1,7 @@
+#pragma once
+#include "abstract-device.hpp"
+
+// serial Device backed by io_uring, returns nullptr if io_uring is unavailable
+// a read into a registered buffer is always kept posted on the tty, so small reads (e.g. xml framing) are served from
+// already received data without a syscall, and writes are submitted together with the read rearm
+auto setup_uring_serial_device(const char* tty_dev) -> Device*;